@@ -0,0 +1,11 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+#include <boost/chrono.hpp>
+
+static inline uint64_t bench_nanosec() {
+    return boost::chrono::duration_cast<boost::chrono::nanoseconds>(boost::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+#endif //BENCH_H
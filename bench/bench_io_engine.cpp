@@ -0,0 +1,156 @@
+#include "bench.h"
+#include "io_engine.h"
+#include "network_client.h"
+
+#include <stdio.h>
+#include <boost/make_shared.hpp>
+#include <boost/weak_ptr.hpp>
+
+#define BENCH_ENGINE_CONNECTIONS	64
+#define BENCH_ENGINE_ROUNDS	2000
+#define BENCH_ENGINE_MESSAGE	512
+
+namespace {
+
+// Sends the message again each time the whole of it has come back.
+class ping_protocol : public iprotocol {
+public:
+    ping_protocol(write_buffer_pt message, boost::atomic<int>* finished)
+    : nc_(nullptr)
+    , message_(message)
+    , pending_(message->size())
+    , rounds_(BENCH_ENGINE_ROUNDS)
+    , finished_(finished) {
+    }
+
+    void start(network_client* nc) {
+        nc_ = nc;
+        nc_->write(message_);
+    }
+
+    virtual void handle_read(char* /* data */, size_t size) {
+        pending_ -= size;
+        if (pending_ > 0) {
+            return;
+        }
+
+        pending_ = message_->size();
+        if (--rounds_ > 0) {
+            nc_->write(message_);
+        } else {
+            (*finished_)++;
+        }
+    }
+
+private:
+    network_client* nc_;
+    write_buffer_pt message_;
+    size_t pending_;
+    int rounds_;
+    boost::atomic<int>* finished_;
+};
+
+typedef boost::asio::ip::tcp::socket server_socket_t;
+
+void echo(boost::shared_ptr<server_socket_t> socket) {
+    char buffer[4096];
+    boost::system::error_code error;
+
+    for (;;) {
+        size_t size = socket->read_some(boost::asio::buffer(buffer), error);
+        if (error) {
+            return;
+        }
+        boost::asio::write(*socket, boost::asio::buffer(buffer, size), error);
+    }
+}
+
+// Round trips per second of BENCH_ENGINE_CONNECTIONS ping-pong connections
+// spread over an engine of the given number of shards.
+double run_shards(size_t shards) {
+    boost::asio::io_service server_io;
+    boost::asio::ip::tcp::acceptor acceptor(server_io, asio_tcp_endpoint_t(boost::asio::ip::address::from_string("127.0.0.1"), 0));
+    int port = acceptor.local_endpoint().port();
+
+    boost::thread server([&]() {
+        for (int i = 0; i < BENCH_ENGINE_CONNECTIONS; i++) {
+            auto socket = boost::make_shared<server_socket_t>(server_io);
+            acceptor.accept(*socket);
+            boost::thread(boost::bind(echo, socket)).detach();
+        }
+    });
+
+    io_engine engine(shards);
+    if (!engine.start()) {
+        printf("  engine start failed: %s\n", engine.last_error_message());
+        return 0;
+    }
+
+    auto message = boost::make_shared<std::string>(BENCH_ENGINE_MESSAGE, 'x');
+    boost::atomic<int> finished(0);
+
+    boost::container::vector<boost::shared_ptr<ping_protocol> > protocols;
+    boost::container::vector<boost::shared_ptr<network_client> > clients;
+    for (int i = 0; i < BENCH_ENGINE_CONNECTIONS; i++) {
+        auto protocol = boost::make_shared<ping_protocol>(message, &finished);
+        auto nc = boost::make_shared<network_client>(protocol.get());
+        nc->set_io_service(engine.pick());
+        nc->connect("127.0.0.1", port);
+
+        protocols.push_back(protocol);
+        clients.push_back(nc);
+    }
+    for (size_t i = 0; i < clients.size(); i++) {
+        clients[i]->wait_connected(5000);
+    }
+    server.join();
+
+    uint64_t start = bench_nanosec();
+    for (size_t i = 0; i < clients.size(); i++) {
+        protocols[i]->start(clients[i].get());
+    }
+    while (finished < BENCH_ENGINE_CONNECTIONS) {
+        boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+    }
+    uint64_t elapsed = bench_nanosec() - start;
+
+    // the protocols must outlive the connections' handlers
+    boost::container::vector<boost::weak_ptr<network_client> > closed;
+    for (size_t i = 0; i < clients.size(); i++) {
+        clients[i]->close();
+        closed.push_back(clients[i]);
+    }
+    clients.clear();
+    for (size_t i = 0; i < closed.size(); i++) {
+        while (!closed[i].expired()) {
+            boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+        }
+    }
+    engine.stop();
+
+    return (double)BENCH_ENGINE_CONNECTIONS * BENCH_ENGINE_ROUNDS * 1e9 / elapsed;
+}
+
+}
+
+// Loopback echo round trips with the same connections on 1, 2, 4 ... shards up
+// to one per hardware thread. The echo server shares the machine, so the curve
+// flattens before the core count.
+void bench_io_engine() {
+    size_t cores = boost::thread::hardware_concurrency();
+    if (cores == 0) {
+        cores = 1;
+    }
+
+    for (size_t shards = 1; ; shards *= 2) {
+        if (shards > cores) {
+            shards = cores;
+        }
+
+        printf("  %zu shards: %.0f round trips/s\n", shards, run_shards(shards));
+
+        if (shards == cores) {
+            break;
+        }
+    }
+}
@@ -0,0 +1,74 @@
+#include "bench.h"
+#include "stanza_ring.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <boost/lexical_cast.hpp>
+
+#define BENCH_RING_STANZAS	1000000
+#define BENCH_RING_SAMPLE	1000
+
+// Pushes small messages from this process to a forked consumer, reporting the
+// throughput and the producer to consumer latency of every 1000th stanza.
+void bench_stanza_ring() {
+    stanza_ring ring;
+    if (!ring.create(1024 * 1024)) {
+        printf("  create failed: %s\n", ring.last_error_message());
+        return;
+    }
+
+    // the child would print what is still buffered again
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        stanza_ring consumer;
+        if (!consumer.attach(ring.fd())) {
+            _exit(1);
+        }
+
+        uint64_t latency = 0;
+        for (int i = 0; i < BENCH_RING_STANZAS; i++) {
+            auto s = consumer.pop(5000);
+            if (s == nullptr) {
+                printf("  consumer stalled at %d\n", i);
+                _exit(1);
+            }
+            if (i % BENCH_RING_SAMPLE == 0) {
+                latency += bench_nanosec() - strtoull(s->get_attr("t"), nullptr, 10);
+            }
+        }
+
+        printf("  consumer: avg latency %.0f ns, %llu wakeups\n",
+               (double)latency / (BENCH_RING_STANZAS / BENCH_RING_SAMPLE), (unsigned long long)consumer.stats().wakeups);
+        fflush(stdout);
+        _exit(0);
+    }
+
+    auto body = stanza::make_stanza("body");
+    body->set_value("hello");
+
+    uint64_t start = bench_nanosec();
+    for (int i = 0; i < BENCH_RING_STANZAS; i++) {
+        auto s = stanza::make_stanza("message");
+        s->add_attr("to", "user@example.com");
+        s->add_attr("id", boost::lexical_cast<std::string>(i).c_str());
+        s->add_attr("t", boost::lexical_cast<std::string>(bench_nanosec()).c_str());
+        s->add_child(body);
+
+        if (!ring.push(s, 5000)) {
+            printf("  push failed: %s\n", ring.last_error_message());
+            break;
+        }
+    }
+
+    int status;
+    waitpid(pid, &status, 0);
+    uint64_t elapsed = bench_nanosec() - start;
+
+    auto stats = ring.stats();
+    printf("  producer: %llu stanzas, %llu bytes in %.1f ms, %.2f M stanzas/s, %llu wakeups\n",
+           (unsigned long long)stats.records, (unsigned long long)stats.bytes, elapsed / 1e6,
+           stats.records / (elapsed / 1e9) / 1e6, (unsigned long long)stats.wakeups);
+}
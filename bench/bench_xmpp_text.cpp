@@ -0,0 +1,80 @@
+#include "bench.h"
+#include "xmpp_protocol.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <iostream>
+
+#define BENCH_TEXT_STREAM_SIZE	(8 << 20)
+#define BENCH_TEXT_MIN_MESSAGES	64
+
+namespace {
+
+class body_handler : public xmpp_handler {
+public:
+    body_handler(size_t body_size) : body_size_(body_size), messages_(0), complete_(0) {}
+
+    virtual void on_sasl(stanza_pt) {}
+    virtual void on_iq(stanza_pt) {}
+    virtual void on_presence(stanza_pt) {}
+    virtual void on_unhandled_stanza(stanza_pt) {}
+
+    virtual void on_message(stanza_pt s) {
+        messages_++;
+
+        auto body = s->get_child("body");
+        if (body != nullptr && strlen(body->value()) == body_size_) {
+            complete_++;
+        }
+    }
+
+    size_t messages() { return messages_; }
+    size_t complete() { return complete_; }
+
+private:
+    size_t body_size_;
+    size_t messages_;
+    size_t complete_;
+};
+
+}
+
+// Parses about 8 MB of messages with 1 to 64 KB bodies, fed in
+// MAX_RECV_BUFF_LEN reads the way network_client delivers them, so each body
+// spans several character data callbacks.
+void bench_xmpp_text() {
+    size_t sizes[] = { 1024, 4096, 16384, 65536 };
+
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        std::string text;
+        for (size_t j = 0; j < sizes[i]; j++) {
+            text += (j % 100 == 99) ? '\n' : (char)('a' + j % 26);
+        }
+
+        size_t count = std::max<size_t>(BENCH_TEXT_STREAM_SIZE / sizes[i], BENCH_TEXT_MIN_MESSAGES);
+        std::string stream = "<stream:stream xmlns='jabber:client' xmlns:stream='http://etherx.jabber.org/streams'>";
+        for (size_t j = 0; j < count; j++) {
+            stream += "<message to='a@example.com' from='b@example.com' type='chat'><body>" + text + "</body></message>";
+        }
+
+        body_handler handler(sizes[i]);
+        xmpp_protocol protocol;
+        protocol.set_xmpp_handler(&handler);
+
+        // the parser logs every callback to std::cout, keep that out of the timing
+        std::streambuf* cout_buffer = std::cout.rdbuf(nullptr);
+
+        uint64_t start = bench_nanosec();
+        for (size_t offset = 0; offset < stream.size(); offset += MAX_RECV_BUFF_LEN) {
+            protocol.handle_read(&stream[offset], std::min<size_t>(MAX_RECV_BUFF_LEN, stream.size() - offset));
+        }
+        uint64_t elapsed = bench_nanosec() - start;
+
+        std::cout.rdbuf(cout_buffer);
+        std::cout.clear();
+
+        printf("  body %6zu: %zu messages, %zu complete, %.1f MB/s\n",
+               sizes[i], handler.messages(), handler.complete(), stream.size() * 1e3 / elapsed);
+    }
+}
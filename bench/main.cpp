@@ -0,0 +1,36 @@
+#include <stdio.h>
+#include <string.h>
+
+void bench_stanza_ring();
+void bench_io_engine();
+void bench_xmpp_text();
+
+struct bench_case {
+    const char* name;
+    void (*run)();
+};
+
+static bench_case benches[] = {
+    { "stanza_ring", bench_stanza_ring },
+    { "io_engine", bench_io_engine },
+    { "xmpp_text", bench_xmpp_text },
+};
+
+// Runs every benchmark, or only those whose names are given.
+int main(int argc, char* argv[]) {
+    for (size_t i = 0; i < sizeof(benches) / sizeof(benches[0]); i++) {
+        bool selected = argc < 2;
+        for (int j = 1; j < argc; j++) {
+            if (strcmp(argv[j], benches[i].name) == 0) {
+                selected = true;
+            }
+        }
+
+        if (selected) {
+            printf("%s\n", benches[i].name);
+            benches[i].run();
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,85 @@
+#include "buffer_pool.h"
+
+buffer_pool& buffer_pool::local() {
+    static thread_local buffer_pool pool;
+    return pool;
+}
+
+buffer_pool::buffer_pool() {
+    stats_.acquired = 0;
+    stats_.allocated = 0;
+    stats_.cached_bytes = 0;
+}
+
+buffer_pool::~buffer_pool() {
+    trim();
+}
+
+int buffer_pool::size_class(size_t size) {
+    size_t class_size = BUFFER_POOL_MIN_SIZE;
+
+    for (int i = 0; i < BUFFER_POOL_CLASSES; i++) {
+        if (size <= class_size) {
+            return i;
+        }
+        class_size *= 2;
+    }
+
+    return -1;
+}
+
+char* buffer_pool::acquire(size_t size, size_t& capacity) {
+    stats_.acquired++;
+
+    int index = size_class(size);
+    if (index < 0) {
+        // larger than any class, not worth keeping
+        stats_.allocated++;
+        capacity = size;
+        return new char[size];
+    }
+
+    capacity = (size_t)BUFFER_POOL_MIN_SIZE << index;
+
+    auto& list = free_[index];
+    if (!list.empty()) {
+        char* data = list.back();
+        list.pop_back();
+        stats_.cached_bytes -= capacity;
+        return data;
+    }
+
+    stats_.allocated++;
+    return new char[capacity];
+}
+
+void buffer_pool::release(char* data, size_t capacity) {
+    if (data == nullptr) {
+        return;
+    }
+
+    int index = size_class(capacity);
+    if (index < 0 || capacity != ((size_t)BUFFER_POOL_MIN_SIZE << index) || free_[index].size() >= BUFFER_POOL_MAX_FREE) {
+        delete[] data;
+        return;
+    }
+
+    free_[index].push_back(data);
+    stats_.cached_bytes += capacity;
+}
+
+void buffer_pool::trim() {
+    for (int i = 0; i < BUFFER_POOL_CLASSES; i++) {
+        for (size_t j = 0; j < free_[i].size(); j++) {
+            delete[] free_[i][j];
+        }
+        free_[i].clear();
+        free_[i].shrink_to_fit();
+    }
+
+    stats_.cached_bytes = 0;
+}
+
+buffer_pool_stats buffer_pool::stats() {
+    return stats_;
+}
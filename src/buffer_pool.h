@@ -0,0 +1,51 @@
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <boost/container/vector.hpp>
+
+#define BUFFER_POOL_CLASSES	5
+#define BUFFER_POOL_MIN_SIZE	1024	// classes double from 1K up to 16K
+#define BUFFER_POOL_MAX_FREE	64	// kept per class, the rest goes back to malloc
+
+struct buffer_pool_stats {
+    uint64_t acquired;
+    uint64_t allocated;	// acquires the free lists could not serve
+    size_t cached_bytes;
+};
+
+// Size classed free lists of receive buffers, one pool per thread. Each shard of
+// io_engine therefore gets its own without locking, filled with memory first
+// touched on its core. Idle connections hold no buffer: they borrow one when
+// their socket becomes readable and hand it back once the data is parsed, so
+// a shard needs about as many buffers as it has connections reading at once.
+//
+// A buffer may be released on another thread than it was acquired on, it then
+// joins that thread's pool.
+class buffer_pool {
+public:
+    // The calling thread's pool.
+    static buffer_pool& local();
+
+    // At least size bytes, capacity gets the usable size to pass to release().
+    char* acquire(size_t size, size_t& capacity);
+    void release(char* data, size_t capacity);
+
+    // Frees every cached buffer.
+    void trim();
+
+    buffer_pool_stats stats();
+
+private:
+    buffer_pool();
+    ~buffer_pool();
+
+    static int size_class(size_t size);
+
+private:
+    boost::container::vector<char*> free_[BUFFER_POOL_CLASSES];
+    buffer_pool_stats stats_;
+};
+
+#endif //BUFFER_POOL_H
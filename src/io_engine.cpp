@@ -0,0 +1,143 @@
+#include "io_engine.h"
+
+#include <string.h>
+#include <boost/bind.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/functional/hash.hpp>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#elif defined(__APPLE__)
+#include <mach/mach.h>
+#include <mach/thread_policy.h>
+#endif
+
+static thread_local int shard_index = -1;
+
+static bool pin_current_thread(int cpu) {
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#elif defined(__APPLE__)
+    // only a hint on macOS: threads with different tags go to different cores
+    thread_affinity_policy_data_t policy = { cpu + 1 };
+    return thread_policy_set(mach_thread_self(), THREAD_AFFINITY_POLICY, (thread_policy_t)&policy, THREAD_AFFINITY_POLICY_COUNT) == KERN_SUCCESS;
+#else
+    return false;
+#endif
+}
+
+io_engine::io_engine(size_t shards, bool pin)
+: size_(shards)
+, pin_(pin)
+, next_(0)
+, ready_(0) {
+    if (size_ == 0) {
+        size_ = boost::thread::hardware_concurrency();
+    }
+    if (size_ == 0) {
+        size_ = 1;
+    }
+}
+
+io_engine::~io_engine() {
+    stop();
+}
+
+bool io_engine::start() {
+    if (!shards_.empty()) {
+        return true;
+    }
+
+    size_t cpus = boost::thread::hardware_concurrency();
+    shards_.resize(size_);
+    ready_ = 0;
+
+    for (size_t i = 0; i < size_; i++) {
+        shards_[i].cpu = pin_ && cpus != 0 ? (int)(i % cpus) : -1;
+        shards_[i].thread = boost::make_shared<boost::thread>(boost::bind(&io_engine::run_shard, this, i));
+    }
+
+    // shards are usable once their io_service exists
+    boost::mutex::scoped_lock lock(mtx_);
+    while (ready_ < size_) {
+        ready_cv_.wait(lock);
+    }
+
+    return true;
+}
+
+void io_engine::stop() {
+    for (size_t i = 0; i < shards_.size(); i++) {
+        shards_[i].work.reset();
+        if (shards_[i].io_service != nullptr) {
+            shards_[i].io_service->stop();
+        }
+    }
+
+    for (size_t i = 0; i < shards_.size(); i++) {
+        if (shards_[i].thread != nullptr && shards_[i].thread->joinable()) {
+            shards_[i].thread->join();
+        }
+    }
+
+    shards_.clear();
+}
+
+size_t io_engine::size() {
+    return size_;
+}
+
+boost::shared_ptr<boost::asio::io_service> io_engine::shard(size_t index) {
+    if (index >= shards_.size()) {
+        return boost::shared_ptr<boost::asio::io_service>();
+    }
+
+    return shards_[index].io_service;
+}
+
+size_t io_engine::pick_index(const char* key) {
+    if (key == nullptr) {
+        return next_.fetch_add(1, boost::memory_order_relaxed) % size_;
+    }
+
+    return boost::hash_range(key, key + strlen(key)) % size_;
+}
+
+boost::shared_ptr<boost::asio::io_service> io_engine::pick(const char* key) {
+    return shard(pick_index(key));
+}
+
+int io_engine::current_shard() {
+    return shard_index;
+}
+
+const char* io_engine::last_error_message() {
+    return last_error_.c_str();
+}
+
+void io_engine::run_shard(size_t index) {
+    auto& shard = shards_[index];
+
+    if (shard.cpu >= 0 && !pin_current_thread(shard.cpu)) {
+        boost::mutex::scoped_lock lock(mtx_);
+        last_error_ = "could not pin shard to cpu " + std::to_string(shard.cpu);
+    }
+    shard_index = (int)index;
+
+    // allocated after pinning, so the reactor and its queues are local to this core
+    shard.io_service = boost::make_shared<boost::asio::io_service>(1);
+    shard.work = boost::make_shared<boost::asio::io_service::work>(*shard.io_service);
+    auto io_service = shard.io_service;
+
+    {
+        boost::mutex::scoped_lock lock(mtx_);
+        ready_++;
+    }
+    ready_cv_.notify_all();
+
+    io_service->run();
+}
@@ -0,0 +1,63 @@
+#ifndef IO_ENGINE_H
+#define IO_ENGINE_H
+
+#include <string>
+#include <boost/asio.hpp>
+#include <boost/thread.hpp>
+#include <boost/atomic.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/container/vector.hpp>
+
+// A fixed set of shards, each an io_service run by one thread pinned to its own
+// core. Connections placed on a shard with network_client::set_io_service()
+// stay there, so their buffers, parser and stanza stack are only ever touched
+// from that core. Every shard creates its io_service on its own thread after
+// pinning, which under first-touch allocation keeps it on the core's memory
+// node; pools keyed by current_shard() get the same.
+class io_engine {
+public:
+    // shards 0 means one per hardware thread.
+    io_engine(size_t shards = 0, bool pin = true);
+    virtual ~io_engine();
+
+    bool start();
+    void stop();
+
+    size_t size();
+    boost::shared_ptr<boost::asio::io_service> shard(size_t index);
+
+    // Round robin when key is null, otherwise a stable hash of key (e.g. the jid).
+    size_t pick_index(const char* key = nullptr);
+    boost::shared_ptr<boost::asio::io_service> pick(const char* key = nullptr);
+
+    // Index of the shard running the calling thread, -1 off the engine.
+    static int current_shard();
+
+    const char* last_error_message();
+
+private:
+    void run_shard(size_t index);
+
+private:
+    struct shard_t {
+        boost::shared_ptr<boost::asio::io_service> io_service;
+        boost::shared_ptr<boost::asio::io_service::work> work;
+        boost::shared_ptr<boost::thread> thread;
+        int cpu;
+    };
+
+    size_t size_;
+    bool pin_;
+    boost::container::vector<shard_t> shards_;
+    boost::atomic<size_t> next_;
+
+    boost::mutex mtx_;
+    boost::condition_variable ready_cv_;
+    size_t ready_;
+
+    std::string last_error_;
+};
+
+typedef boost::shared_ptr<io_engine> io_engine_pt;
+
+#endif //IO_ENGINE_H
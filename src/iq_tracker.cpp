@@ -0,0 +1,281 @@
+#include "iq_tracker.h"
+#include "auto_lock.h"
+
+#include <boost/system/error_code.hpp>
+
+#define IQ_TRACKER_INITIAL_SLOTS	64
+
+static const char base32_digits[] = "0123456789abcdefghijklmnopqrstuv";
+
+iq_tracker::iq_tracker(const char* prefix)
+: prefix_(prefix)
+, next_seq_(1)
+, count_(0)
+, slots_(IQ_TRACKER_INITIAL_SLOTS) {
+    mtx_ = boost::make_shared<boost::mutex>();
+}
+
+void iq_tracker::set_account(const char* bare_jid, const char* domain) {
+    auto_lock lock(mtx_);
+    bare_jid_ = bare_jid;
+    domain_ = domain;
+}
+
+uint32_t iq_tracker::add(iq_callback_t callback, int timeout_millisec, std::string& id, const char* to) {
+    slot s;
+    s.callback = callback;
+    if (to != nullptr) {
+        s.to = to;
+    }
+    s.deadline = boost::posix_time::microsec_clock::universal_time() + boost::posix_time::milliseconds(timeout_millisec);
+
+    {
+        auto_lock lock(mtx_);
+
+        do {
+            s.seq = next_seq_++;
+            if (next_seq_ == 0) {
+                next_seq_ = 1;
+            }
+        } while (find(s.seq) != slots_.size());
+
+        if ((count_ + 1) * 2 > slots_.size()) {
+            grow();
+        }
+
+        insert(s);
+        count_++;
+    }
+
+    encode_id(s.seq, id);
+    return s.seq;
+}
+
+bool iq_tracker::remove(uint32_t seq) {
+    auto_lock lock(mtx_);
+
+    auto pos = find(seq);
+    if (pos == slots_.size()) {
+        return false;
+    }
+
+    erase(pos);
+    count_--;
+    return true;
+}
+
+bool iq_tracker::complete(stanza_pt reply) {
+    const char* id = reply->get_attr("id");
+    uint32_t seq = 0;
+
+    if (id == nullptr || !decode_id(id, seq)) {
+        return false;
+    }
+
+    iq_callback_t callback;
+    {
+        auto_lock lock(mtx_);
+
+        auto pos = find(seq);
+        if (pos == slots_.size() || !from_matches(slots_[pos].to, reply->get_attr("from"))) {
+            return false;
+        }
+
+        callback.swap(slots_[pos].callback);
+        erase(pos);
+        count_--;
+    }
+
+    if (callback) {
+        callback(reply, boost::system::error_code());
+    }
+
+    return true;
+}
+
+size_t iq_tracker::expire() {
+    auto now = boost::posix_time::microsec_clock::universal_time();
+    boost::container::vector<iq_callback_t> expired;
+
+    {
+        auto_lock lock(mtx_);
+
+        // start right after an empty slot, the table is at most half full, so
+        // every cluster is walked front to back and a backward shift that
+        // wraps around the end never moves an entry behind pos
+        size_t mask = slots_.size() - 1;
+        size_t pos = 0;
+        while (slots_[pos].seq != 0) {
+            pos++;
+        }
+        pos = (pos + 1) & mask;
+
+        size_t visited = 0;
+        while (visited < slots_.size()) {
+            if (slots_[pos].seq != 0 && slots_[pos].deadline <= now) {
+                expired.push_back(iq_callback_t());
+                expired.back().swap(slots_[pos].callback);
+                erase(pos);
+                count_--;
+                // erase shifted a later entry into pos, look at it again
+                continue;
+            }
+            pos = (pos + 1) & mask;
+            visited++;
+        }
+    }
+
+    auto error = boost::system::errc::make_error_code(boost::system::errc::timed_out);
+    BOOST_FOREACH(auto& callback, expired) {
+        if (callback) {
+            callback(stanza_pt(), error);
+        }
+    }
+
+    return expired.size();
+}
+
+void iq_tracker::cancel_all(const boost::system::error_code& error) {
+    slots_t cancelled(IQ_TRACKER_INITIAL_SLOTS);
+
+    {
+        auto_lock lock(mtx_);
+        cancelled.swap(slots_);
+        count_ = 0;
+    }
+
+    BOOST_FOREACH(auto& s, cancelled) {
+        if (s.seq != 0 && s.callback) {
+            s.callback(stanza_pt(), error);
+        }
+    }
+}
+
+size_t iq_tracker::pending() {
+    auto_lock lock(mtx_);
+    return count_;
+}
+
+// RFC 6120 8.1.2.1: a request without to is answered on behalf of our
+// account, with no from, our bare jid or the server's domain.
+bool iq_tracker::from_matches(const std::string& to, const char* from) {
+    if (from == nullptr || *from == '\0') {
+        return to.empty();
+    }
+
+    if (to.empty()) {
+        return (!bare_jid_.empty() && bare_jid_ == from) || (!domain_.empty() && domain_ == from);
+    }
+
+    return to == from;
+}
+
+void iq_tracker::encode_id(uint32_t seq, std::string& id) {
+    char digits[8];
+    int n = 0;
+
+    do {
+        digits[n++] = base32_digits[seq & 31];
+        seq >>= 5;
+    } while (seq != 0);
+
+    id = prefix_;
+    while (n > 0) {
+        id += digits[--n];
+    }
+}
+
+bool iq_tracker::decode_id(const char* id, uint32_t& seq) {
+    if (strncmp(id, prefix_.c_str(), prefix_.size()) != 0) {
+        return false;
+    }
+
+    const char* p = id + prefix_.size();
+    if (*p == '\0' || strlen(p) > 7) {
+        return false;
+    }
+
+    uint64_t value = 0;
+    for (; *p != '\0'; p++) {
+        int digit;
+        if (*p >= '0' && *p <= '9') {
+            digit = *p - '0';
+        } else if (*p >= 'a' && *p <= 'v') {
+            digit = *p - 'a' + 10;
+        } else {
+            return false;
+        }
+        value = (value << 5) | digit;
+    }
+
+    if (value == 0 || value > 0xffffffff) {
+        return false;
+    }
+
+    seq = (uint32_t)value;
+    return true;
+}
+
+// Sequence numbers are handed out consecutively, so the low bits already
+// spread entries evenly over the table.
+size_t iq_tracker::find(uint32_t seq) {
+    size_t mask = slots_.size() - 1;
+    size_t pos = seq & mask;
+
+    while (slots_[pos].seq != 0) {
+        if (slots_[pos].seq == seq) {
+            return pos;
+        }
+        pos = (pos + 1) & mask;
+    }
+
+    return slots_.size();
+}
+
+void iq_tracker::insert(slot& s) {
+    size_t mask = slots_.size() - 1;
+    size_t pos = s.seq & mask;
+
+    while (slots_[pos].seq != 0) {
+        pos = (pos + 1) & mask;
+    }
+
+    slots_[pos].seq = s.seq;
+    slots_[pos].deadline = s.deadline;
+    slots_[pos].callback.swap(s.callback);
+    slots_[pos].to.swap(s.to);
+}
+
+void iq_tracker::erase(size_t pos) {
+    size_t mask = slots_.size() - 1;
+    size_t next = (pos + 1) & mask;
+
+    while (slots_[next].seq != 0) {
+        size_t home = slots_[next].seq & mask;
+
+        // move next back into the hole unless its home lies in (pos, next]
+        if (((next - home) & mask) >= ((next - pos) & mask)) {
+            slots_[pos].seq = slots_[next].seq;
+            slots_[pos].deadline = slots_[next].deadline;
+            slots_[pos].callback.swap(slots_[next].callback);
+            slots_[pos].to.swap(slots_[next].to);
+            pos = next;
+        }
+        next = (next + 1) & mask;
+    }
+
+    slots_[pos].seq = 0;
+    slots_[pos].callback.clear();
+    slots_[pos].to.clear();
+}
+
+void iq_tracker::grow() {
+    slots_t old(slots_.size() * 2);
+    old.swap(slots_);
+
+    BOOST_FOREACH(auto& s, old) {
+        if (s.seq != 0) {
+            insert(s);
+        }
+    }
+}
@@ -0,0 +1,79 @@
+#ifndef __IQ_TRACKER_H__
+#define __IQ_TRACKER_H__
+
+#include "stanza.h"
+
+#include <stdint.h>
+#include <boost/function.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/system/error_code.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+typedef boost::function<void (stanza_pt, const boost::system::error_code&)> iq_callback_t;
+
+// Correlates outstanding iq requests with their replies by id. The ids are
+// predictable, so a reply only counts when it also comes from the entity the
+// request was addressed to.
+//
+// Ids are a short prefix followed by a base-32 sequence number, so a reply id
+// decodes straight back to the slot key without hashing strings. Pending
+// requests live in an open addressing table (linear probing, backward shift
+// deletion) which keeps lookups cache friendly with many requests in flight.
+class iq_tracker {
+public:
+    iq_tracker(const char* prefix = "q");
+
+    // Our bare jid and server domain, which answer requests sent without a to.
+    void set_account(const char* bare_jid, const char* domain);
+
+    // Registers a request addressed to to (null or empty for our own account)
+    // and writes its id into id. Returns the sequence key.
+    uint32_t add(iq_callback_t callback, int timeout_millisec, std::string& id, const char* to = nullptr);
+
+    // Forgets a request without running its callback, e.g. when it could not be sent.
+    bool remove(uint32_t seq);
+
+    // Completes the request matching reply's id and from. Returns false if the
+    // id is not ours or the reply comes from someone the request did not go to.
+    bool complete(stanza_pt reply);
+
+    // Fails every request whose deadline has passed. Returns the number expired.
+    size_t expire();
+
+    // Fails every pending request with error, e.g. on disconnect.
+    void cancel_all(const boost::system::error_code& error);
+
+    size_t pending();
+
+private:
+    struct slot {
+        slot() : seq(0) {}
+
+        uint32_t seq;
+        iq_callback_t callback;
+        boost::posix_time::ptime deadline;
+        std::string to;
+    };
+
+    typedef boost::container::vector<slot> slots_t;
+
+    void encode_id(uint32_t seq, std::string& id);
+    bool decode_id(const char* id, uint32_t& seq);
+    bool from_matches(const std::string& to, const char* from);
+
+    size_t find(uint32_t seq);
+    void insert(slot& s);
+    void erase(size_t pos);
+    void grow();
+
+private:
+    std::string prefix_;
+    std::string bare_jid_;
+    std::string domain_;
+    uint32_t next_seq_;
+    size_t count_;
+    slots_t slots_;
+    boost::shared_ptr<boost::mutex> mtx_;
+};
+
+#endif  // __IQ_TRACKER_H__
@@ -0,0 +1,369 @@
+#include "journal.h"
+#include "network_client.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <boost/atomic.hpp>
+#include <boost/chrono.hpp>
+#include <boost/thread/thread.hpp>
+
+#define JOURNAL_ALIGN(n)	(((n) + 7) & ~(size_t)7)
+
+static uint64_t wall_nanosec() {
+    return boost::chrono::duration_cast<boost::chrono::nanoseconds>(boost::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+static uint64_t steady_nanosec() {
+    return boost::chrono::duration_cast<boost::chrono::nanoseconds>(boost::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static std::string segment_name(uint32_t index) {
+    char name[32];
+    snprintf(name, sizeof(name), "journal-%08u.log", index);
+    return name;
+}
+
+static bool parse_segment_name(const char* name, uint32_t& index) {
+    unsigned int value = 0;
+    char tail[8] = {0,};
+
+    if (strlen(name) != 20 || sscanf(name, "journal-%8u.%3s", &value, tail) != 2 || strcmp(tail, "log") != 0) {
+        return false;
+    }
+
+    index = value;
+    return true;
+}
+
+static boost::container::vector<std::string> list_segments(const std::string& dir) {
+    boost::container::vector<std::string> names;
+
+    auto d = opendir(dir.c_str());
+    if (d == nullptr) {
+        return names;
+    }
+
+    uint32_t index;
+    while (auto entry = readdir(d)) {
+        if (parse_segment_name(entry->d_name, index)) {
+            names.push_back(entry->d_name);
+        }
+    }
+    closedir(d);
+
+    // zero padded indexes sort correctly as strings
+    std::sort(names.begin(), names.end());
+    return names;
+}
+
+journal_writer::journal_writer(const char* dir, size_t segment_size)
+: dir_(dir)
+, segment_size_(segment_size)
+, next_index_(0)
+, next_conn_(0)
+, fd_(-1)
+, base_(nullptr)
+, mapped_size_(0)
+, offset_(0) {
+}
+
+journal_writer::~journal_writer() {
+    close();
+}
+
+bool journal_writer::open() {
+    boost::mutex::scoped_lock lock(mtx_);
+
+    mkdir(dir_.c_str(), 0755);
+
+    auto segments = list_segments(dir_);
+    next_index_ = 0;
+    if (!segments.empty()) {
+        parse_segment_name(segments.back().c_str(), next_index_);
+        next_index_++;
+    }
+
+    // replay filters on the conn id alone, so ids carry on from earlier runs
+    journal_reader reader(dir_.c_str());
+    journal_record record;
+    if (reader.open()) {
+        while (reader.next(record)) {
+            next_conn_ = std::max(next_conn_, record.conn);
+        }
+    }
+
+    return open_segment(segment_size_);
+}
+
+void journal_writer::close() {
+    boost::mutex::scoped_lock lock(mtx_);
+    close_segment();
+}
+
+uint32_t journal_writer::add_connection() {
+    boost::mutex::scoped_lock lock(mtx_);
+
+    if (++next_conn_ == 0) {
+        next_conn_ = 1;
+    }
+    return next_conn_;
+}
+
+bool journal_writer::append(uint32_t conn, journal_direction direction, const char* data, size_t size) {
+    // a zero size would read back as the end of the segment
+    if (size == 0) {
+        return true;
+    }
+
+    size_t record_size = sizeof(journal_record_header) + JOURNAL_ALIGN(size);
+
+    boost::mutex::scoped_lock lock(mtx_);
+
+    if (base_ == nullptr) {
+        return false;
+    }
+
+    // keep room for the zero header that terminates the segment
+    if (offset_ + record_size + sizeof(journal_record_header) > mapped_size_) {
+        close_segment();
+        if (!open_segment(std::max(segment_size_, sizeof(journal_segment_header) + record_size + sizeof(journal_record_header)))) {
+            return false;
+        }
+    }
+
+    auto header = (journal_record_header*)(base_ + offset_);
+    header->direction = direction;
+    header->timestamp_nanosec = wall_nanosec();
+    header->conn = conn;
+    header->reserved = 0;
+    memcpy(base_ + offset_ + sizeof(journal_record_header), data, size);
+
+    // size last, a reader of a crashed segment stops at a half written record
+    boost::atomic_thread_fence(boost::memory_order_release);
+    header->size = (uint32_t)size;
+
+    offset_ += record_size;
+    return true;
+}
+
+const char* journal_writer::last_error_message() {
+    return last_error_.c_str();
+}
+
+bool journal_writer::open_segment(size_t min_size) {
+    auto path = dir_ + "/" + segment_name(next_index_);
+
+    fd_ = ::open(path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd_ < 0) {
+        last_error_ = path + ": " + strerror(errno);
+        return false;
+    }
+
+    if (ftruncate(fd_, (off_t)min_size) != 0) {
+        last_error_ = path + ": " + strerror(errno);
+        ::close(fd_);
+        fd_ = -1;
+        return false;
+    }
+
+    auto base = mmap(nullptr, min_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+    if (base == MAP_FAILED) {
+        last_error_ = path + ": " + strerror(errno);
+        ::close(fd_);
+        fd_ = -1;
+        return false;
+    }
+
+    base_ = (char*)base;
+    mapped_size_ = min_size;
+
+    auto header = (journal_segment_header*)base_;
+    header->magic = JOURNAL_MAGIC;
+    header->index = next_index_;
+    header->created_nanosec = wall_nanosec();
+    offset_ = sizeof(journal_segment_header);
+
+    next_index_++;
+    return true;
+}
+
+void journal_writer::close_segment() {
+    if (base_ == nullptr) {
+        return;
+    }
+
+    msync(base_, offset_, MS_ASYNC);
+    munmap(base_, mapped_size_);
+
+    // drop the unused tail but keep one zero header as the end marker
+    if (ftruncate(fd_, (off_t)(offset_ + sizeof(journal_record_header))) != 0) {
+        last_error_ = strerror(errno);
+    }
+    ::close(fd_);
+
+    fd_ = -1;
+    base_ = nullptr;
+    mapped_size_ = 0;
+    offset_ = 0;
+}
+
+journal_reader::journal_reader(const char* dir)
+: dir_(dir)
+, segment_(0)
+, fd_(-1)
+, base_(nullptr)
+, mapped_size_(0)
+, offset_(0) {
+}
+
+journal_reader::~journal_reader() {
+    unmap_segment();
+}
+
+bool journal_reader::open() {
+    unmap_segment();
+
+    segments_ = list_segments(dir_);
+    segment_ = 0;
+
+    return !segments_.empty() && map_segment(0);
+}
+
+bool journal_reader::next(journal_record& record) {
+    while (base_ != nullptr) {
+        if (offset_ + sizeof(journal_record_header) <= mapped_size_) {
+            auto header = (const journal_record_header*)(base_ + offset_);
+            size_t record_size = sizeof(journal_record_header) + JOURNAL_ALIGN(header->size);
+
+            if (header->size != 0 && offset_ + record_size <= mapped_size_) {
+                record.conn = header->conn;
+                record.direction = (journal_direction)header->direction;
+                record.timestamp_nanosec = header->timestamp_nanosec;
+                record.data = base_ + offset_ + sizeof(journal_record_header);
+                record.size = header->size;
+
+                offset_ += record_size;
+                return true;
+            }
+        }
+
+        if (segment_ + 1 >= segments_.size() || !map_segment(segment_ + 1)) {
+            unmap_segment();
+        }
+    }
+
+    return false;
+}
+
+bool journal_reader::map_segment(size_t i) {
+    unmap_segment();
+    segment_ = i;
+
+    auto path = dir_ + "/" + segments_[i];
+    fd_ = ::open(path.c_str(), O_RDONLY);
+    if (fd_ < 0) {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd_, &st) != 0 || (size_t)st.st_size < sizeof(journal_segment_header)) {
+        ::close(fd_);
+        fd_ = -1;
+        return false;
+    }
+
+    // private and writable, so replayed chunks can be handed out as char*
+    auto base = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd_, 0);
+    if (base == MAP_FAILED) {
+        ::close(fd_);
+        fd_ = -1;
+        return false;
+    }
+
+    base_ = (const char*)base;
+    mapped_size_ = st.st_size;
+    offset_ = sizeof(journal_segment_header);
+
+    if (((const journal_segment_header*)base_)->magic != JOURNAL_MAGIC) {
+        unmap_segment();
+        return false;
+    }
+
+    madvise(base, mapped_size_, MADV_SEQUENTIAL);
+    return true;
+}
+
+void journal_reader::unmap_segment() {
+    if (base_ != nullptr) {
+        munmap((void*)base_, mapped_size_);
+        base_ = nullptr;
+    }
+
+    if (fd_ >= 0) {
+        ::close(fd_);
+        fd_ = -1;
+    }
+
+    mapped_size_ = 0;
+    offset_ = 0;
+}
+
+journal_replay::journal_replay(const char* dir)
+: dir_(dir) {
+}
+
+bool journal_replay::run(iprotocol* protocol, journal_replay_stats& stats, bool paced, journal_direction direction, uint32_t conn) {
+    stats.records = 0;
+    stats.bytes = 0;
+    stats.elapsed_nanosec = 0;
+
+    journal_reader reader(dir_.c_str());
+    if (!reader.open()) {
+        return false;
+    }
+
+    journal_record record;
+    uint64_t first_timestamp = 0;
+    uint64_t start = steady_nanosec();
+
+    while (reader.next(record)) {
+        if (record.direction != direction) {
+            continue;
+        }
+
+        if (conn == 0) {
+            conn = record.conn;
+        } else if (record.conn != conn) {
+            continue;
+        }
+
+        if (paced) {
+            if (stats.records == 0) {
+                first_timestamp = record.timestamp_nanosec;
+            }
+
+            // wall clock timestamps, so tolerate a clock stepping backwards
+            uint64_t offset = record.timestamp_nanosec > first_timestamp ? record.timestamp_nanosec - first_timestamp : 0;
+            uint64_t due = start + offset;
+            uint64_t now = steady_nanosec();
+            if (due > now) {
+                boost::this_thread::sleep_for(boost::chrono::nanoseconds(due - now));
+            }
+        }
+
+        protocol->handle_read(const_cast<char*>(record.data), record.size);
+
+        stats.records++;
+        stats.bytes += record.size;
+    }
+
+    stats.elapsed_nanosec = steady_nanosec() - start;
+    return true;
+}
@@ -0,0 +1,140 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stdint.h>
+#include <string>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/container/vector.hpp>
+
+#define JOURNAL_DEFAULT_SEGMENT_SIZE	(64 * 1024 * 1024)
+#define JOURNAL_MAGIC	0x324a4e43	// "CNJ2"
+
+class iprotocol;
+
+// Append-only capture of the raw byte streams of connections, kept in memory
+// mapped segment files (journal-00000000.log, ...) under one directory.
+//
+// A segment starts with a journal_segment_header followed by records, each a
+// journal_record_header and its data padded to 8 bytes. Segments are created
+// at full size, so the first all-zero record header marks the end; empty
+// records are therefore never written.
+//
+// One writer may be shared by several connections, each gets its own conn id
+// from add_connection() and replay picks a single one of them.
+
+enum journal_direction {
+    JOURNAL_INBOUND = 1,
+    JOURNAL_OUTBOUND = 2,
+};
+
+struct journal_segment_header {
+    uint32_t magic;
+    uint32_t index;
+    uint64_t created_nanosec;
+};
+
+struct journal_record_header {
+    uint32_t size;
+    uint32_t direction;
+    uint64_t timestamp_nanosec;
+    uint32_t conn;
+    uint32_t reserved;
+};
+
+class journal_writer {
+public:
+    journal_writer(const char* dir, size_t segment_size = JOURNAL_DEFAULT_SEGMENT_SIZE);
+    virtual ~journal_writer();
+
+    // Starts a new segment after any already in dir. Conn ids continue after
+    // the highest one recorded there.
+    bool open();
+    void close();
+
+    // A new conn id for append, never 0.
+    uint32_t add_connection();
+
+    // Nothing is recorded for size 0.
+    bool append(uint32_t conn, journal_direction direction, const char* data, size_t size);
+
+    const char* last_error_message();
+
+private:
+    bool open_segment(size_t min_size);
+    void close_segment();
+
+private:
+    std::string dir_;
+    size_t segment_size_;
+    uint32_t next_index_;
+    uint32_t next_conn_;
+
+    int fd_;
+    char* base_;
+    size_t mapped_size_;
+    size_t offset_;
+
+    std::string last_error_;
+    boost::mutex mtx_;
+};
+
+typedef boost::shared_ptr<journal_writer> journal_writer_pt;
+
+struct journal_record {
+    uint32_t conn;
+    journal_direction direction;
+    uint64_t timestamp_nanosec;
+    const char* data;
+    size_t size;
+};
+
+// Walks the records of every segment in dir, oldest first.
+class journal_reader {
+public:
+    journal_reader(const char* dir);
+    virtual ~journal_reader();
+
+    bool open();
+    bool next(journal_record& record);
+
+private:
+    bool map_segment(size_t i);
+    void unmap_segment();
+
+private:
+    std::string dir_;
+    boost::container::vector<std::string> segments_;
+    size_t segment_;
+
+    int fd_;
+    const char* base_;
+    size_t mapped_size_;
+    size_t offset_;
+};
+
+struct journal_replay_stats {
+    uint64_t records;
+    uint64_t bytes;
+    uint64_t elapsed_nanosec;
+
+    double megabytes_per_sec() const {
+        return elapsed_nanosec == 0 ? 0.0 : (double)bytes * 1000.0 / (double)elapsed_nanosec;
+    }
+};
+
+// Feeds recorded chunks of one direction of one connection back through
+// protocol->handle_read, either as fast as possible (parser throughput on real
+// traffic) or with the original gaps between chunks. conn 0 replays the
+// connection of the first matching record.
+class journal_replay {
+public:
+    journal_replay(const char* dir);
+
+    bool run(iprotocol* protocol, journal_replay_stats& stats, bool paced = false, journal_direction direction = JOURNAL_INBOUND, uint32_t conn = 0);
+
+private:
+    std::string dir_;
+};
+
+#endif //JOURNAL_H
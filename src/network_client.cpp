@@ -1,15 +1,52 @@
 #include "network_client.h"
 #include "openssl_cert.h"
+#include "trace.h"
+
+#include <errno.h>
+#include <algorithm>
 
 network_client::network_client(iprotocol_pt protocol, bool use_ssl)
 : strand_(nullptr)
+, shared_io_service_(false)
+, socket_(nullptr)
 , ssl_socket_(nullptr)
 , protocol_(protocol)
+, resolver_(caching_resolver::shared())
+, journal_conn_(0)
+, port_(0)
+, srv_pending_(0)
+, next_endpoint_(0)
+, failed_attempts_(0)
 , connected_(false)
-, use_ssl_(use_ssl) {
+, closed_(true)
+, receive_buffer_(nullptr)
+, receive_capacity_(0)
+, pooled_receive_(false)
+, use_ssl_(use_ssl)
+, ktls_(false)
+, ktls_ssl_(nullptr)
+, ktls_send_(false)
+, ktls_recv_(false)
+, transport_id_(0) {
 }
 
-bool network_client::connect(const char* ip, int port) {
+network_client::~network_client() {
+    buffer_pool::local().release(receive_buffer_, receive_capacity_);
+    
+    // a connect() that failed before anything ran on the strand
+    free_ktls_ssl();
+    
+    // the last handler may release us on our own io thread
+    if (t_.joinable()) {
+        if (t_.get_id() == boost::this_thread::get_id()) {
+            t_.detach();
+        } else {
+            t_.join();
+        }
+    }
+}
+
+bool network_client::connect(const char* host, int port, bool use_srv, connect_handler_t handler) {
     if (connected_) {
         last_error_ = boost::system::errc::make_error_code(boost::system::errc::already_connected);
         return false;
@@ -31,21 +68,70 @@ bool network_client::connect(const char* ip, int port) {
         return false;
     }
     
-    asio_ssl_context_t ssl_context(*io_service_, asio_ssl_context_t::tlsv1);
+    // the kernel only implements TLS 1.2 and 1.3 records
+    asio_ssl_context_t ssl_context(*io_service_, ktls_ ? asio_ssl_context_t::sslv23_client : asio_ssl_context_t::tlsv1);
     ssl_context.set_verify_mode(asio_ssl_context_t::verify_none);
     
     ssl_context.use_certificate(boost::asio::const_buffer(cert_buff.data(), cert_buff.size()), asio_ssl_context_t::asn1);
     ssl_context.use_private_key(boost::asio::const_buffer(key_buff.data(), key_buff.size()), asio_ssl_context_t::asn1);
     
-    ssl_socket_ = ssl_socket_pt(new asio_ssl_socket_t(*io_service_, ssl_context));
+    // the asio ssl stream carries about 80K of buffers, only made when it is used
+    ssl_socket_.reset();
+    socket_ = socket_pt(new asio_socket_t(*io_service_));
+    if (use_ssl_ && !ktls_) {
+        ssl_socket_ = ssl_socket_pt(new asio_ssl_socket_t(*socket_, ssl_context));
+        if (pooled_receive_) {
+            SSL_set_mode(ssl_socket_->native_handle(), SSL_MODE_RELEASE_BUFFERS);
+        }
+    }
+    
+    free_ktls_ssl();
     
+    if (use_ssl_ && ktls_) {
+        ssl_context.set_options(asio_ssl_context_t::no_sslv2 | asio_ssl_context_t::no_sslv3 | asio_ssl_context_t::no_tlsv1 | asio_ssl_context_t::no_tlsv1_1);
+        
+        // holds its own reference to the context
+        ktls_ssl_ = SSL_new(ssl_context.native_handle());
+        if (ktls_ssl_ == nullptr) {
+            last_error_ = ssl_error_code(SSL_ERROR_SSL);
+            return false;
+        }
+#ifdef SSL_OP_ENABLE_KTLS
+        SSL_set_options(ktls_ssl_, SSL_OP_ENABLE_KTLS);
+#endif
+        SSL_set_connect_state(ktls_ssl_);
+        if (pooled_receive_) {
+            SSL_set_mode(ktls_ssl_, SSL_MODE_RELEASE_BUFFERS);
+        }
+    }
+    attempt_timer_ = deadline_timer_pt(new asio_deadline_timer_t(*io_service_));
+    closed_ = false;
     
-    auto endpoint = boost::asio::ip::tcp::endpoint(
-                                                   boost::asio::ip::address::from_string(ip), port);
+    host_ = host;
+    port_ = port;
+    connect_handler_ = handler;
     
-    ssl_socket_->next_layer().async_connect(endpoint, strand_->wrap(boost::bind(&network_client::handle_connect, this, boost::asio::placeholders::error)));
+    boost::system::error_code ec;
+    auto address = boost::asio::ip::address::from_string(host, ec);
+    
+    if (!ec) {
+        endpoints_t endpoints(1, asio_tcp_endpoint_t(address, port));
+        strand_->post(boost::bind(&network_client::start_connect, shared_from_this(), endpoints));
+    } else {
+        // the resolver answers from its own thread, keep run() alive until then
+        resolve_work_ = work_pt(new asio_io_service_t::work(*io_service_));
+        
+        if (use_srv) {
+            resolver_->async_resolve_srv(XMPP_CLIENT_SRV_PREFIX + host_, strand_->wrap(boost::bind(&network_client::handle_resolve_srv, shared_from_this(), _1, _2, _3)));
+        } else {
+            resolver_->async_resolve(host_, port_, strand_->wrap(boost::bind(&network_client::handle_resolve, shared_from_this(), _1, _2, _3)));
+        }
+    }
     
-    t_ = boost::thread(boost::bind(static_cast<size_t (boost::asio::io_service::*)()>(&boost::asio::io_service::run), io_service_));
+    // a transport or engine runs a shared io_service on its own thread
+    if (!shared_io_service_) {
+        t_ = boost::thread(boost::bind(static_cast<size_t (boost::asio::io_service::*)()>(&boost::asio::io_service::run), io_service_));
+    }
    
     return true;
 }
@@ -67,35 +153,59 @@ bool network_client::wait_connected(int timeout_millisec) {
 }
 
 void network_client::close() {
-    ssl_socket_->get_io_service().stop();
-    ssl_socket_->lowest_layer().close();
+    // only the first one, our own io_service may have run out of work since
+    if (strand_ == nullptr || closed_.exchange(true)) {
+        return;
+    }
     
+    // writes fail from here on, the rest waits for the handler running on the strand
     connected_ = false;
+    strand_->dispatch(boost::bind(&network_client::handle_close, shared_from_this()));
+}
+
+void network_client::handle_close() {
+    connected_ = false;
+    
+    boost::system::error_code ignored;
+    for (size_t i = 0; i < attempts_.size(); i++) {
+        attempts_[i]->close(ignored);
+    }
+    if (attempt_timer_ != nullptr) {
+        attempt_timer_->cancel();
+    }
+    
+    if (transport_id_ != 0) {
+        // the strand runs on the transport thread, the kernel keeps the socket until then
+        transport_->detach(transport_id_);
+        transport_id_ = 0;
+    }
+    if (socket_ != nullptr) {
+        socket_->close(ignored);
+    }
+    free_ktls_ssl();
+    
+    // our own io_service runs out of work once the aborted handlers have run,
+    // and its thread ends. Last, dropping the owner may destroy the protocol.
+    owner_.reset();
 }
 
-bool network_client::write(char* data, size_t size) {
-    if (!connected_ || !ssl_socket_->lowest_layer().is_open()) {
+bool network_client::write(char* data, size_t size, write_handler_t handler) {
+    // the caller's buffer may be gone before the write completes, so keep a copy
+    return write(boost::make_shared<std::string>(data, size), handler);
+}
+
+bool network_client::write(write_buffer_pt buffer, write_handler_t handler) {
+    if (!connected_ || !socket_->is_open()) {
         last_error_ = boost::system::errc::make_error_code(boost::system::errc::not_connected);
         return false;
     }
     
-    if (use_ssl_) {
-        boost::asio::async_write(
-                                 *ssl_socket_,
-                                 boost::asio::buffer(data, size),
-                                 strand_->wrap(boost::bind(&network_client::handle_write,
-                                                           this,
-                                                           boost::asio::placeholders::error,
-                                                           boost::asio::placeholders::bytes_transferred)));
-    } else {
-        boost::asio::async_write(
-                                 ssl_socket_->next_layer(),
-                                 boost::asio::buffer(data, size),
-                                 strand_->wrap(boost::bind(&network_client::handle_write,
-                                                           this,
-                                                           boost::asio::placeholders::error,
-                                                           boost::asio::placeholders::bytes_transferred)));
+    // let the strand serialize it behind any writes still in flight
+    TRACE_POINT(TRACE_WRITE_QUEUED, protocol_, buffer->size());
+    if (journal_ != nullptr) {
+        journal_->append(journal_conn_, JOURNAL_OUTBOUND, buffer->data(), buffer->size());
     }
+    strand_->post(boost::bind(&network_client::queue_write, shared_from_this(), buffer, handler));
     
     return true;
 }
@@ -105,6 +215,77 @@ bool network_client::is_connected() {
     return connected_;
 }
 
+bool network_client::is_encrypted() {
+    return use_ssl_;
+}
+
+io_service_pt network_client::get_io_service() {
+    if (io_service_ == nullptr) {
+        io_service_ = io_service_pt(new asio_io_service_t());
+    }
+    
+    return io_service_;
+}
+
+void network_client::set_io_service(io_service_pt io_service) {
+    io_service_ = io_service;
+    shared_io_service_ = io_service != nullptr;
+}
+
+void network_client::set_resolver(iresolver_pt resolver) {
+    resolver_ = resolver;
+}
+
+void network_client::set_journal(journal_writer_pt journal) {
+    journal_ = journal;
+    journal_conn_ = journal != nullptr ? journal->add_connection() : 0;
+}
+
+void network_client::set_owner(boost::shared_ptr<void> owner) {
+    owner_ = owner;
+}
+
+void network_client::set_ktls(bool enable) {
+    ktls_ = enable;
+}
+
+void network_client::set_pooled_receive(bool enable) {
+    pooled_receive_ = enable;
+}
+
+size_t network_client::memory_footprint() {
+    size_t size = sizeof(*this);
+    
+    if (socket_ != nullptr) {
+        size += sizeof(asio_socket_t);
+    }
+    if (ssl_socket_ != nullptr) {
+        size += sizeof(asio_ssl_socket_t);
+    }
+    if (receive_buffer_ != nullptr) {
+        size += receive_capacity_;
+    }
+    
+    return size;
+}
+
+void network_client::set_transport(uring_transport_pt transport) {
+    if (transport == nullptr || !transport->is_open()) {
+        return;
+    }
+    
+    transport_ = transport;
+    set_io_service(transport->get_io_service());
+}
+
+bool network_client::ktls_send_active() {
+    return ktls_send_;
+}
+
+bool network_client::ktls_recv_active() {
+    return ktls_recv_;
+}
+
 const char* network_client::last_error_message() {
     if (last_error_.value() == 0) {
         return "";
@@ -122,73 +303,401 @@ bool network_client::make_certificate(boost::container::vector<unsigned char>& c
     return cert.make(cert_buff, key_buff);
 }
 
+void network_client::handle_resolve(const boost::system::error_code& error, const endpoints_t& endpoints, int /* ttl_sec */) {
+    resolve_work_.reset();
+    
+    if (error) {
+        handle_connect(error);
+        return;
+    }
+    
+    start_connect(endpoints);
+}
+
+void network_client::handle_resolve_srv(const boost::system::error_code& error, const srv_records_t& records, int /* ttl_sec */) {
+    if (error || records.empty()) {
+        // no SRV records published, fall back to the domain itself
+        resolver_->async_resolve(host_, port_, strand_->wrap(boost::bind(&network_client::handle_resolve, shared_from_this(), _1, _2, _3)));
+        return;
+    }
+    
+    // RFC 2782: lowest priority first, heavier weights first within a priority
+    srv_records_ = records;
+    std::stable_sort(srv_records_.begin(), srv_records_.end(), [](const srv_record& a, const srv_record& b) {
+        return a.priority != b.priority ? a.priority < b.priority : a.weight > b.weight;
+    });
+    
+    srv_endpoints_.clear();
+    srv_endpoints_.resize(srv_records_.size());
+    srv_pending_ = srv_records_.size();
+    
+    for (size_t i = 0; i < srv_records_.size(); i++) {
+        resolver_->async_resolve(srv_records_[i].target, srv_records_[i].port, strand_->wrap(boost::bind(&network_client::handle_resolve_target, shared_from_this(), i, _1, _2, _3)));
+    }
+}
+
+void network_client::handle_resolve_target(size_t index, const boost::system::error_code& error, const endpoints_t& endpoints, int ttl_sec) {
+    if (!error) {
+        srv_endpoints_[index] = endpoints;
+    }
+    
+    if (--srv_pending_ > 0) {
+        return;
+    }
+    
+    endpoints_t all;
+    for (size_t i = 0; i < srv_endpoints_.size(); i++) {
+        all.insert(all.end(), srv_endpoints_[i].begin(), srv_endpoints_[i].end());
+    }
+    
+    if (all.empty()) {
+        handle_resolve(boost::asio::error::host_not_found, all, 0);
+        return;
+    }
+    
+    handle_resolve(boost::system::error_code(), all, ttl_sec);
+}
+
+// Happy eyeballs (RFC 8305): alternate address families keeping the resolver's
+// order, and start the next attempt if the current one has not finished within
+// CONNECT_ATTEMPT_DELAY_MILLISEC. The first socket to connect wins.
+void network_client::start_connect(const endpoints_t& endpoints) {
+    // closed while the resolver was answering
+    if (closed_) {
+        handle_connect(boost::asio::error::operation_aborted);
+        return;
+    }
+    
+    endpoints_t v6, v4;
+    for (size_t i = 0; i < endpoints.size(); i++) {
+        (endpoints[i].address().is_v6() ? v6 : v4).push_back(endpoints[i]);
+    }
+    
+    bool v6_first = !endpoints.empty() && endpoints[0].address().is_v6();
+    endpoints_t& first = v6_first ? v6 : v4;
+    endpoints_t& second = v6_first ? v4 : v6;
+    
+    endpoints_.clear();
+    for (size_t i = 0; i < std::max(first.size(), second.size()); i++) {
+        if (i < first.size()) {
+            endpoints_.push_back(first[i]);
+        }
+        if (i < second.size()) {
+            endpoints_.push_back(second[i]);
+        }
+    }
+    
+    next_endpoint_ = 0;
+    failed_attempts_ = 0;
+    attempts_.clear();
+    
+    start_attempt();
+}
+
+void network_client::start_attempt() {
+    if (next_endpoint_ >= endpoints_.size()) {
+        return;
+    }
+    
+    auto socket = socket_pt(new asio_socket_t(*io_service_));
+    attempts_.push_back(socket);
+    
+    socket->async_connect(endpoints_[next_endpoint_++], strand_->wrap(boost::bind(&network_client::handle_attempt, shared_from_this(), socket, boost::asio::placeholders::error)));
+    
+    if (next_endpoint_ < endpoints_.size()) {
+        attempt_timer_->expires_from_now(boost::posix_time::milliseconds(CONNECT_ATTEMPT_DELAY_MILLISEC));
+        attempt_timer_->async_wait(strand_->wrap(boost::bind(&network_client::handle_attempt_timer, shared_from_this(), boost::asio::placeholders::error)));
+    }
+}
+
+void network_client::handle_attempt_timer(const boost::system::error_code& error) {
+    if (error || attempts_.empty()) {
+        return;
+    }
+    
+    start_attempt();
+}
+
+void network_client::handle_attempt(socket_pt socket, const boost::system::error_code& error) {
+    if (attempts_.empty()) {
+        // another attempt already won
+        return;
+    }
+    
+    if (closed_) {
+        attempts_.clear();
+        handle_connect(boost::asio::error::operation_aborted);
+        return;
+    }
+    
+    if (error) {
+        boost::system::error_code ignored;
+        socket->close(ignored);
+        
+        if (++failed_attempts_ < endpoints_.size()) {
+            // nothing else in flight, don't wait for the timer
+            if (failed_attempts_ == next_endpoint_) {
+                attempt_timer_->cancel();
+                start_attempt();
+            }
+            return;
+        }
+        
+        attempts_.clear();
+        handle_connect(error);
+        return;
+    }
+    
+    attempt_timer_->cancel();
+    for (size_t i = 0; i < attempts_.size(); i++) {
+        if (attempts_[i] != socket) {
+            boost::system::error_code ignored;
+            attempts_[i]->close(ignored);
+        }
+    }
+    attempts_.clear();
+    
+    // in place, the ssl stream refers to socket_
+    *socket_ = std::move(*socket);
+    
+    handle_connect(error);
+}
+
 void network_client::handle_connect(const boost::system::error_code& error) {
     if (error) {
         last_error_ = error;
         connected_ = false;
         close();
+        complete_connect(error);
         return;
     }
     
    
-    if (use_ssl_) {
+    if (ktls_ssl_ != nullptr) {
+        boost::asio::socket_base::non_blocking_io non_blocking_io(true);
+        socket_->io_control(non_blocking_io);
+        
+        SSL_set_fd(ktls_ssl_, (int)socket_->native_handle());
+        ktls_handshake(error);
+    } else if (use_ssl_) {
         ssl_socket_->async_handshake(boost::asio::ssl::stream_base::client,
-                                     boost::bind(&network_client::handle_handshake, this, boost::asio::placeholders::error));
+                                     strand_->wrap(boost::bind(&network_client::handle_handshake, shared_from_this(), boost::asio::placeholders::error)));
     } else {
         boost::asio::ip::tcp::no_delay no_delay(true);
         boost::asio::socket_base::non_blocking_io non_blocking_io(true);
-        ssl_socket_->lowest_layer().io_control(non_blocking_io);
-        ssl_socket_->lowest_layer().set_option(no_delay);
+        socket_->io_control(non_blocking_io);
+        socket_->set_option(no_delay);
         
         connected_ = true;
         
         post_read();
+        complete_connect(error);
     }
 }
 
 void network_client::handle_handshake(const boost::system::error_code& error) {
-    if (error) {
-        last_error_ = error;
+    if (error || closed_) {
+        last_error_ = error ? error : boost::asio::error::operation_aborted;
         connected_ = false;
+        close();
+        complete_connect(last_error_);
         return;
     }
     
     boost::asio::ip::tcp::no_delay no_delay(true);
     boost::asio::socket_base::non_blocking_io non_blocking_io(true);
-    ssl_socket_->lowest_layer().io_control(non_blocking_io);
-    ssl_socket_->lowest_layer().set_option(no_delay);
+    socket_->io_control(non_blocking_io);
+    socket_->set_option(no_delay);
     
     connected_ = true;
     
     post_read();
+    complete_connect(error);
+}
+
+void network_client::complete_connect(const boost::system::error_code& error) {
+    connect_handler_t handler;
+    handler.swap(connect_handler_);
+    
+    if (handler) {
+        handler(error);
+    }
+}
+
+void network_client::ktls_handshake(const boost::system::error_code& error) {
+    if (error || ktls_ssl_ == nullptr) {
+        handle_handshake(error ? error : boost::asio::error::operation_aborted);
+        return;
+    }
+    
+    ERR_clear_error();
+    int ret = SSL_do_handshake(ktls_ssl_);
+    
+    if (ret == 1) {
+#ifdef BIO_get_ktls_send
+        // OpenSSL has installed the keys with setsockopt(SOL_TLS) if it could
+        ktls_send_ = BIO_get_ktls_send(SSL_get_wbio(ktls_ssl_)) != 0;
+        ktls_recv_ = BIO_get_ktls_recv(SSL_get_rbio(ktls_ssl_)) != 0;
+#endif
+        
+        handle_handshake(error);
+        return;
+    }
+    
+    int ssl_error = SSL_get_error(ktls_ssl_, ret);
+    if (!ktls_wait(ssl_error, &network_client::ktls_handshake)) {
+        handle_handshake(ssl_error_code(ssl_error));
+    }
+}
+
+// With kTLS active SSL_read/SSL_write are plain recvmsg/sendmsg on the socket;
+// only control records (alerts, session tickets) still pass through OpenSSL.
+void network_client::handle_ktls_read(const boost::system::error_code& error) {
+    // closed while the readiness wait was pending
+    if (error || ktls_ssl_ == nullptr || !connected_) {
+        handle_read(error ? error : boost::asio::error::operation_aborted, 0);
+        return;
+    }
+    
+    acquire_receive_buffer();
+    ERR_clear_error();
+    int ret = SSL_read(ktls_ssl_, receive_buffer_, (int)receive_capacity_);
+    
+    if (ret > 0) {
+        handle_read(error, ret);
+        return;
+    }
+    
+    release_receive_buffer();
+    int ssl_error = SSL_get_error(ktls_ssl_, ret);
+    if (ssl_error == SSL_ERROR_ZERO_RETURN) {
+        handle_read(boost::asio::error::eof, 0);
+        return;
+    }
+    
+    if (!ktls_wait(ssl_error, &network_client::handle_ktls_read)) {
+        handle_read(ssl_error_code(ssl_error), 0);
+    }
+}
+
+void network_client::handle_ktls_write(const boost::system::error_code& error) {
+    if (error || ktls_ssl_ == nullptr || !connected_) {
+        handle_write(error ? error : boost::asio::error::operation_aborted, 0);
+        return;
+    }
+    
+    auto buffer = write_queue_.front().first;
+    if (buffer->empty()) {
+        handle_write(error, 0);
+        return;
+    }
+    
+    // a retry after SSL_ERROR_WANT_WRITE must pass the same buffer again, which
+    // holds since the front of the queue only moves on in handle_write
+    ERR_clear_error();
+    int ret = SSL_write(ktls_ssl_, buffer->data(), (int)buffer->size());
+    
+    if (ret > 0) {
+        handle_write(error, ret);
+        return;
+    }
+    
+    int ssl_error = SSL_get_error(ktls_ssl_, ret);
+    if (!ktls_wait(ssl_error, &network_client::handle_ktls_write)) {
+        handle_write(ssl_error_code(ssl_error), 0);
+    }
+}
+
+void network_client::free_ktls_ssl() {
+    if (ktls_ssl_ != nullptr) {
+        SSL_free(ktls_ssl_);
+        ktls_ssl_ = nullptr;
+    }
+    ktls_send_ = ktls_recv_ = false;
+}
+
+bool network_client::ktls_wait(int ssl_error, void (network_client::*next)(const boost::system::error_code&)) {
+    if (ssl_error == SSL_ERROR_WANT_READ) {
+        socket_->async_read_some(boost::asio::null_buffers(),
+                                 strand_->wrap(boost::bind(next, shared_from_this(), boost::asio::placeholders::error)));
+        return true;
+    }
+    
+    if (ssl_error == SSL_ERROR_WANT_WRITE) {
+        socket_->async_write_some(boost::asio::null_buffers(),
+                                  strand_->wrap(boost::bind(next, shared_from_this(), boost::asio::placeholders::error)));
+        return true;
+    }
+    
+    return false;
+}
+
+boost::system::error_code network_client::ssl_error_code(int ssl_error) {
+    unsigned long code = ERR_get_error();
+    
+    if (code != 0) {
+        return boost::system::error_code((int)code, boost::asio::error::get_ssl_category());
+    }
+    
+    if (ssl_error == SSL_ERROR_SYSCALL && errno != 0) {
+        return boost::system::error_code(errno, boost::system::system_category());
+    }
+    
+    return boost::asio::error::connection_reset;
 }
 
 void network_client::post_read() {
-    if (!ssl_socket_->lowest_layer().is_open()) {
+    // close() may have run since the read that brought us here
+    if (!connected_ || !socket_->is_open()) {
         return;
     }
     
-    receive_buffer_.assign(0);
-    if (use_ssl_) {
-        boost::asio::async_read(*ssl_socket_,
-                                boost::asio::buffer(receive_buffer_),
+    if (transport_ != nullptr && !use_ssl_) {
+        // multishot, one attach keeps receiving until detach
+        transport_id_ = transport_->attach((int)socket_->native_handle(),
+                                           boost::bind(&network_client::handle_transport_read, shared_from_this(), _1, _2, _3));
+        if (transport_id_ != 0) {
+            return;
+        }
+    }
+    
+    // everything read so far has been parsed
+    release_receive_buffer();
+    
+    if (ktls_ssl_ != nullptr) {
+        // decrypted bytes may already wait inside OpenSSL without the socket being readable
+        if (SSL_pending(ktls_ssl_) > 0) {
+            strand_->post(boost::bind(&network_client::handle_ktls_read, shared_from_this(), boost::system::error_code()));
+        } else {
+            socket_->async_read_some(boost::asio::null_buffers(),
+                                     strand_->wrap(boost::bind(&network_client::handle_ktls_read, shared_from_this(), boost::asio::placeholders::error)));
+        }
+    } else if (use_ssl_) {
+        // the asio ssl stream needs the buffer while it waits, so it keeps one
+        acquire_receive_buffer();
+        // async_read would wait for a full buffer and hold back small stanzas
+        ssl_socket_->async_read_some(boost::asio::buffer(receive_buffer_, receive_capacity_),
                                 strand_->wrap(boost::bind(
                                                           &network_client::handle_read,
-                                                          this,
+                                                          shared_from_this(),
                                                           boost::asio::placeholders::error,
                                                           boost::asio::placeholders::bytes_transferred)));
+    } else if (pooled_receive_) {
+        socket_->async_read_some(boost::asio::null_buffers(),
+                                 strand_->wrap(boost::bind(&network_client::handle_readable, shared_from_this(), boost::asio::placeholders::error)));
     } else {
-//        boost::asio::async_read(ssl_socket_->next_layer(),
+        acquire_receive_buffer();
+//        boost::asio::async_read(*socket_,
 //                                boost::asio::buffer(receive_buffer_),
 //                                strand_->wrap(boost::bind(
 //                                                          &network_client::handle_read,
 //                                                          this,
 //                                                          boost::asio::placeholders::error,
 //                                                          boost::asio::placeholders::bytes_transferred)));
-        ssl_socket_->next_layer().async_read_some(boost::asio::buffer(receive_buffer_),
+        socket_->async_read_some(boost::asio::buffer(receive_buffer_, receive_capacity_),
                                 strand_->wrap(boost::bind(
                                                           &network_client::handle_read,
-                                                          this,
+                                                          shared_from_this(),
                                                           boost::asio::placeholders::error,
                                                           boost::asio::placeholders::bytes_transferred)));
     }
@@ -196,29 +705,144 @@ void network_client::post_read() {
 }
 
 void network_client::handle_read(const boost::system::error_code& error, size_t bytes_transferred) {
+    if (deliver_read(error, receive_buffer_, bytes_transferred)) {
+        post_read();
+    } else {
+        release_receive_buffer();
+    }
+}
+
+void network_client::handle_readable(const boost::system::error_code& error) {
+    if (error) {
+        handle_read(error, 0);
+        return;
+    }
+    
+    // the socket is non blocking, a readiness that went stale just waits again
+    acquire_receive_buffer();
+    boost::system::error_code read_error;
+    size_t size = socket_->read_some(boost::asio::buffer(receive_buffer_, receive_capacity_), read_error);
+    
+    if (read_error == boost::asio::error::would_block) {
+        post_read();
+        return;
+    }
+    
+    handle_read(read_error, size);
+}
+
+void network_client::acquire_receive_buffer() {
+    if (receive_buffer_ == nullptr) {
+        receive_buffer_ = buffer_pool::local().acquire(MAX_RECV_BUFF_LEN, receive_capacity_);
+    }
+}
+
+void network_client::release_receive_buffer() {
+    // without pooling the buffer stays until the connection is destroyed
+    if (pooled_receive_ && receive_buffer_ != nullptr) {
+        buffer_pool::local().release(receive_buffer_, receive_capacity_);
+        receive_buffer_ = nullptr;
+    }
+}
+
+void network_client::handle_transport_read(const boost::system::error_code& error, char* data, size_t size) {
+    deliver_read(error, data, size);
+}
+
+bool network_client::deliver_read(const boost::system::error_code& error, char* data, size_t size) {
+    if (error == boost::asio::error::operation_aborted) {
+        return false;
+    }
+    
     if (error) {
         last_error_ = error;
         printf("%s", error.message().c_str());
         close();
-        return;
+        return false;
     }
     
-    if (bytes_transferred == 0) {
+    if (size == 0) {
         last_error_ = boost::system::errc::make_error_code(boost::system::errc::connection_refused);
         close();
-        return;
+        return false;
     }
     
-    protocol_->handle_read(receive_buffer_.c_array(), bytes_transferred);
+    TRACE_POINT(TRACE_SOCKET_READ, protocol_, size);
+    if (journal_ != nullptr) {
+        journal_->append(journal_conn_, JOURNAL_INBOUND, data, size);
+    }
+    protocol_->handle_read(data, size);
     
+    return true;
+}
+
+void network_client::queue_write(write_buffer_pt buffer, write_handler_t handler) {
+    write_queue_.push_back(std::make_pair(buffer, handler));
     
-    post_read();
+    if (write_queue_.size() == 1) {
+        start_write();
+    }
+}
+
+void network_client::start_write() {
+    if (!connected_) {
+        handle_write(boost::asio::error::operation_aborted, 0);
+        return;
+    }
+    
+    auto buffer = write_queue_.front().first;
+    
+    if (transport_id_ != 0) {
+        if (!transport_->send(transport_id_, buffer->data(), buffer->size(),
+                              boost::bind(&network_client::handle_write, shared_from_this(), _1, _2))) {
+            handle_write(boost::system::errc::make_error_code(boost::system::errc::not_connected), 0);
+        }
+    } else if (ktls_ssl_ != nullptr) {
+        handle_ktls_write(boost::system::error_code());
+    } else if (use_ssl_) {
+        boost::asio::async_write(
+                                 *ssl_socket_,
+                                 boost::asio::buffer(*buffer),
+                                 strand_->wrap(boost::bind(&network_client::handle_write,
+                                                           shared_from_this(),
+                                                           boost::asio::placeholders::error,
+                                                           boost::asio::placeholders::bytes_transferred)));
+    } else {
+        boost::asio::async_write(
+                                 *socket_,
+                                 boost::asio::buffer(*buffer),
+                                 strand_->wrap(boost::bind(&network_client::handle_write,
+                                                           shared_from_this(),
+                                                           boost::asio::placeholders::error,
+                                                           boost::asio::placeholders::bytes_transferred)));
+    }
 }
 
 void network_client::handle_write(const boost::system::error_code& error, size_t bytes_transferred) {
     if (error) {
         last_error_ = error;
         printf("error raised %s\n", error.message().c_str());
+        
+        // nothing behind a failed write can be sent any more
+        boost::container::deque<std::pair<write_buffer_pt, write_handler_t> > failed;
+        failed.swap(write_queue_);
+        for (size_t i = 0; i < failed.size(); i++) {
+            if (failed[i].second) {
+                failed[i].second(error, i == 0 ? bytes_transferred : 0);
+            }
+        }
         return;
     }
+    
+    TRACE_POINT(TRACE_WRITE_COMPLETED, protocol_, bytes_transferred);
+    auto handler = write_queue_.front().second;
+    write_queue_.pop_front();
+    
+    if (handler) {
+        handler(error, bytes_transferred);
+    }
+    
+    if (!write_queue_.empty()) {
+        start_write();
+    }
 }
@@ -6,10 +6,19 @@
 #include <boost/asio/ssl.hpp>
 #include <boost/bind.hpp>
 #include <boost/container/vector.hpp>
-#include <boost/array.hpp>
+#include <boost/container/deque.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/enable_shared_from_this.hpp>
 #include <boost/atomic.hpp>
 
+#include "resolver.h"
+#include "journal.h"
+#include "uring_transport.h"
+#include "buffer_pool.h"
+
 #define MAX_RECV_BUFF_LEN	8092
+#define CONNECT_ATTEMPT_DELAY_MILLISEC	250
+#define XMPP_CLIENT_SRV_PREFIX	"_xmpp-client._tcp."
 
 class network_client;
 
@@ -28,23 +37,87 @@ typedef boost::asio::ip::tcp::socket asio_socket_t;
 typedef boost::shared_ptr<asio_socket_t> socket_pt;
 typedef boost::asio::io_service::strand asio_strand_t;
 typedef boost::shared_ptr<asio_strand_t> strand_pt;
-typedef boost::asio::ssl::stream<asio_socket_t> asio_ssl_socket_t;
+typedef boost::asio::ssl::stream<asio_socket_t&> asio_ssl_socket_t;
 typedef boost::shared_ptr<asio_ssl_socket_t> ssl_socket_pt;
 typedef boost::asio::ssl::context asio_ssl_context_t;
+typedef boost::shared_ptr<std::string> write_buffer_pt;
+typedef boost::function<void (const boost::system::error_code&)> connect_handler_t;
+typedef boost::function<void (const boost::system::error_code&, size_t)> write_handler_t;
+typedef boost::shared_ptr<asio_io_service_t::work> work_pt;
+typedef boost::asio::deadline_timer asio_deadline_timer_t;
+typedef boost::shared_ptr<asio_deadline_timer_t> deadline_timer_pt;
 
 
-class network_client {
+// Pending handlers hold a shared_ptr to the connection, so create it with
+// boost::make_shared. It lives until close() has run on the strand and the
+// aborted operations have completed.
+class network_client : public boost::enable_shared_from_this<network_client> {
     
 public:
     network_client(iprotocol_pt protocol, bool use_ssl = false);
-    virtual ~network_client() {}
+    virtual ~network_client();
     
-    bool connect(const char* ip, int port);
+    // host may be an ip literal or a name. Names are resolved asynchronously
+    // through the resolver, after an _xmpp-client._tcp SRV lookup if use_srv.
+    // handler, if given, runs on the strand once connected or on failure.
+    bool connect(const char* host, int port, bool use_srv = false, connect_handler_t handler = connect_handler_t());
     bool wait_connected(int timeout_millisec);
+    // May be called from any thread, the sockets and timers are closed on the strand.
     void close();
-    bool write(char* data, size_t size);
+    
+    // handler, if given, runs on the strand once this buffer has been written.
+    bool write(char* data, size_t size, write_handler_t handler = write_handler_t());
+    // Same without the copy, buffer must not change afterwards. Batches of
+    // stanzas serialized back to back go out as one write this way.
+    bool write(write_buffer_pt buffer, write_handler_t handler = write_handler_t());
 
     bool is_connected();
+    // With use_ssl, whether records go through userspace TLS or kTLS.
+    bool is_encrypted();
+    
+    // Created on first use, so timers can be set up before connect.
+    io_service_pt get_io_service();
+    
+    // Runs the connection on an io_service someone else runs, such as a shard of
+    // io_engine. connect then starts no thread and close leaves it running.
+    // Set before connect and before get_io_service.
+    void set_io_service(io_service_pt io_service);
+    
+    // Defaults to caching_resolver::shared(). Set before connect.
+    void set_resolver(iresolver_pt resolver);
+    
+    // Records inbound and outbound bytes, may be shared between connections:
+    // each one records under its own journal_conn().
+    void set_journal(journal_writer_pt journal);
+    uint32_t journal_conn() { return journal_conn_; }
+    
+    // Kept alive until close, typically whoever owns the protocol, so handlers
+    // still running never see it destroyed.
+    void set_owner(boost::shared_ptr<void> owner);
+    
+    // With use_ssl, drive OpenSSL directly on the socket and let it hand record
+    // encryption to the kernel (kTLS) after the handshake. Where the kernel or
+    // cipher does not allow it, the same path keeps encrypting in userspace.
+    // Set before connect.
+    void set_ktls(bool enable);
+    bool ktls_send_active();
+    bool ktls_recv_active();
+    
+    // Moves plain tcp reads and writes onto a shared io_uring transport. The
+    // connection then runs on the transport's io_service and thread; ssl
+    // connections only share the thread. Set before connect and before
+    // get_io_service, ignored if the transport is not open.
+    void set_transport(uring_transport_pt transport);
+    
+    // Plain tcp and kTLS connections then wait for readability with no buffer
+    // attached, borrow one from buffer_pool::local() to read and parse, and
+    // give it back before waiting again. OpenSSL also frees its record buffers
+    // while idle. Set before connect.
+    void set_pooled_receive(bool enable);
+    
+    // Bytes the connection itself keeps allocated right now: this object, the
+    // ssl stream if any and the receive buffer it holds, not the parser.
+    size_t memory_footprint();
     
     const char* last_error_message();
     int last_error_code();
@@ -53,25 +126,83 @@ private:
     
     bool make_certificate(boost::container::vector<unsigned char>& cert_buff, boost::container::vector<unsigned char>& key_buff);
     void post_read();
+    void handle_close();
+    void queue_write(write_buffer_pt buffer, write_handler_t handler);
+    void start_write();
+    
+    void handle_resolve(const boost::system::error_code& error, const endpoints_t& endpoints, int ttl_sec);
+    void handle_resolve_srv(const boost::system::error_code& error, const srv_records_t& records, int ttl_sec);
+    void handle_resolve_target(size_t index, const boost::system::error_code& error, const endpoints_t& endpoints, int ttl_sec);
+    
+    void start_connect(const endpoints_t& endpoints);
+    void start_attempt();
+    void handle_attempt(socket_pt socket, const boost::system::error_code& error);
+    void handle_attempt_timer(const boost::system::error_code& error);
     
     void handle_connect(const boost::system::error_code& error);
+    void complete_connect(const boost::system::error_code& error);
+    
+    void ktls_handshake(const boost::system::error_code& error);
+    void handle_ktls_read(const boost::system::error_code& error);
+    void handle_ktls_write(const boost::system::error_code& error);
+    bool ktls_wait(int ssl_error, void (network_client::*next)(const boost::system::error_code&));
+    void free_ktls_ssl();
+    boost::system::error_code ssl_error_code(int ssl_error);
     void handle_handshake(const boost::system::error_code& error);
     void handle_read(const boost::system::error_code& error, size_t bytes_transferred);
+    void handle_transport_read(const boost::system::error_code& error, char* data, size_t size);
+    bool deliver_read(const boost::system::error_code& error, char* data, size_t size);
+    void handle_readable(const boost::system::error_code& error);
+    void acquire_receive_buffer();
+    void release_receive_buffer();
     void handle_write(const boost::system::error_code& error, size_t bytes_transferred);
     
 private:
     strand_pt strand_;
     io_service_pt io_service_;
+    bool shared_io_service_;
+    socket_pt socket_;
+    // only with use_ssl_ and without kTLS, wraps socket_
     ssl_socket_pt ssl_socket_;
     iprotocol_pt protocol_;
+    boost::shared_ptr<void> owner_;
+    iresolver_pt resolver_;
+    journal_writer_pt journal_;
+    uint32_t journal_conn_;
+    
+    std::string host_;
+    int port_;
+    work_pt resolve_work_;
+    srv_records_t srv_records_;
+    boost::container::vector<endpoints_t> srv_endpoints_;
+    size_t srv_pending_;
+    
+    endpoints_t endpoints_;
+    size_t next_endpoint_;
+    size_t failed_attempts_;
+    boost::container::vector<socket_pt> attempts_;
+    deadline_timer_pt attempt_timer_;
     
     boost::atomic<bool> connected_;
-    boost::array<char, MAX_RECV_BUFF_LEN> receive_buffer_;
+    boost::atomic<bool> closed_;
+    char* receive_buffer_;
+    size_t receive_capacity_;
+    bool pooled_receive_;
+    boost::container::deque<std::pair<write_buffer_pt, write_handler_t> > write_queue_;
+    connect_handler_t connect_handler_;
     
     boost::thread t_;
     boost::system::error_code last_error_;
     
     bool use_ssl_;
+    
+    bool ktls_;
+    SSL* ktls_ssl_;
+    bool ktls_send_;
+    bool ktls_recv_;
+    
+    uring_transport_pt transport_;
+    uint32_t transport_id_;
 };
 
 #endif //NETWORK_CLIENT_H
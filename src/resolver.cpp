@@ -0,0 +1,308 @@
+#include "resolver.h"
+
+#include <algorithm>
+#include <boost/bind.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include <netinet/in.h>
+#include <arpa/nameser.h>
+#include <resolv.h>
+
+system_resolver::system_resolver(size_t threads) {
+    work_ = boost::make_shared<boost::asio::io_service::work>(boost::ref(io_service_));
+
+    if (threads == 0) {
+        threads = 1;
+    }
+    for (size_t i = 0; i < threads; i++) {
+        threads_.create_thread(boost::bind(static_cast<size_t (boost::asio::io_service::*)()>(&boost::asio::io_service::run), &io_service_));
+    }
+}
+
+system_resolver::~system_resolver() {
+    work_.reset();
+    io_service_.stop();
+    threads_.join_all();
+}
+
+void system_resolver::async_resolve(const std::string& host, int port, resolve_handler_t handler) {
+    io_service_.post(boost::bind(&system_resolver::do_resolve, this, host, port, handler));
+}
+
+void system_resolver::async_resolve_srv(const std::string& name, srv_handler_t handler) {
+    io_service_.post(boost::bind(&system_resolver::do_resolve_srv, this, name, handler));
+}
+
+void system_resolver::do_resolve(std::string host, int port, resolve_handler_t handler) {
+    boost::system::error_code error;
+    endpoints_t endpoints;
+
+    boost::asio::ip::tcp::resolver resolver(io_service_);
+    boost::asio::ip::tcp::resolver::query query(host, boost::lexical_cast<std::string>(port), boost::asio::ip::tcp::resolver::query::address_configured);
+    auto it = resolver.resolve(query, error);
+
+    for (; !error && it != boost::asio::ip::tcp::resolver::iterator(); ++it) {
+        endpoints.push_back(it->endpoint());
+    }
+
+    if (!error && endpoints.empty()) {
+        error = boost::asio::error::host_not_found;
+    }
+
+    // getaddrinfo does not report record ttls
+    handler(error, endpoints, error ? RESOLVER_NEGATIVE_TTL_SEC : RESOLVER_DEFAULT_TTL_SEC);
+}
+
+void system_resolver::do_resolve_srv(std::string name, srv_handler_t handler) {
+    srv_records_t records;
+    unsigned char answer[NS_PACKETSZ * 4];
+    int ttl_sec = RESOLVER_NEGATIVE_TTL_SEC;
+
+    struct __res_state state;
+    memset(&state, 0, sizeof(state));
+    if (res_ninit(&state) != 0) {
+        handler(boost::asio::error::no_recovery, records, ttl_sec);
+        return;
+    }
+
+    int len = res_nquery(&state, name.c_str(), ns_c_in, ns_t_srv, answer, sizeof(answer));
+    res_nclose(&state);
+
+    if (len < 0) {
+        handler(boost::asio::error::host_not_found, records, ttl_sec);
+        return;
+    }
+
+    ns_msg msg;
+    if (ns_initparse(answer, len, &msg) != 0) {
+        handler(boost::asio::error::no_recovery, records, ttl_sec);
+        return;
+    }
+
+    uint32_t min_ttl = 0xffffffff;
+    int count = ns_msg_count(msg, ns_s_an);
+
+    for (int i = 0; i < count; i++) {
+        ns_rr rr;
+        if (ns_parserr(&msg, ns_s_an, i, &rr) != 0 || ns_rr_type(rr) != ns_t_srv || ns_rr_rdlen(rr) < 7) {
+            continue;
+        }
+
+        const unsigned char* rdata = ns_rr_rdata(rr);
+        char target[NS_MAXDNAME];
+        if (dn_expand(ns_msg_base(msg), ns_msg_end(msg), rdata + 6, target, sizeof(target)) < 0) {
+            continue;
+        }
+
+        // a lone "." target means the service is explicitly not offered
+        if (target[0] == '\0' || strcmp(target, ".") == 0) {
+            continue;
+        }
+
+        srv_record record;
+        record.priority = ns_get16(rdata);
+        record.weight = ns_get16(rdata + 2);
+        record.port = ns_get16(rdata + 4);
+        record.target = target;
+        records.push_back(record);
+
+        min_ttl = std::min(min_ttl, ns_rr_ttl(rr));
+    }
+
+    if (records.empty()) {
+        handler(boost::asio::error::host_not_found, records, ttl_sec);
+        return;
+    }
+
+    handler(boost::system::error_code(), records, (int)std::min<uint32_t>(min_ttl, 0x7fffffff));
+}
+
+void static_resolver::add_host(const std::string& host, const char* ip) {
+    boost::mutex::scoped_lock lock(mtx_);
+    hosts_[host].push_back(boost::asio::ip::address::from_string(ip));
+}
+
+void static_resolver::add_srv(const std::string& name, const std::string& target, uint16_t port, uint16_t priority, uint16_t weight) {
+    srv_record record;
+    record.target = target;
+    record.port = port;
+    record.priority = priority;
+    record.weight = weight;
+
+    boost::mutex::scoped_lock lock(mtx_);
+    srvs_[name].push_back(record);
+}
+
+void static_resolver::async_resolve(const std::string& host, int port, resolve_handler_t handler) {
+    endpoints_t endpoints;
+    {
+        boost::mutex::scoped_lock lock(mtx_);
+
+        auto it = hosts_.find(host);
+        if (it != hosts_.end()) {
+            for (size_t i = 0; i < it->second.size(); i++) {
+                endpoints.push_back(boost::asio::ip::tcp::endpoint(it->second[i], port));
+            }
+        }
+    }
+
+    if (endpoints.empty()) {
+        handler(boost::asio::error::host_not_found, endpoints, RESOLVER_NEGATIVE_TTL_SEC);
+    } else {
+        handler(boost::system::error_code(), endpoints, RESOLVER_DEFAULT_TTL_SEC);
+    }
+}
+
+void static_resolver::async_resolve_srv(const std::string& name, srv_handler_t handler) {
+    srv_records_t records;
+    {
+        boost::mutex::scoped_lock lock(mtx_);
+
+        auto it = srvs_.find(name);
+        if (it != srvs_.end()) {
+            records = it->second;
+        }
+    }
+
+    if (records.empty()) {
+        handler(boost::asio::error::host_not_found, records, RESOLVER_NEGATIVE_TTL_SEC);
+    } else {
+        handler(boost::system::error_code(), records, RESOLVER_DEFAULT_TTL_SEC);
+    }
+}
+
+caching_resolver::caching_resolver(iresolver_pt upstream)
+: upstream_(upstream) {
+}
+
+iresolver_pt caching_resolver::shared() {
+    static iresolver_pt instance = boost::make_shared<caching_resolver>(boost::make_shared<system_resolver>());
+    return instance;
+}
+
+void caching_resolver::clear() {
+    boost::mutex::scoped_lock lock(mtx_);
+
+    // keep lookups in flight so their waiters are still answered
+    for (auto it = hosts_.begin(); it != hosts_.end();) {
+        it = it->second.in_flight ? ++it : hosts_.erase(it);
+    }
+    for (auto it = srvs_.begin(); it != srvs_.end();) {
+        it = it->second.in_flight ? ++it : srvs_.erase(it);
+    }
+}
+
+void caching_resolver::sweep(const boost::posix_time::ptime& now) {
+    if (!next_sweep_.is_not_a_date_time() && next_sweep_ > now) {
+        return;
+    }
+    next_sweep_ = now + boost::posix_time::seconds(RESOLVER_SWEEP_SEC);
+
+    erase_expired(hosts_, now);
+    erase_expired(srvs_, now);
+}
+
+template<typename Map>
+void caching_resolver::erase_expired(Map& entries, const boost::posix_time::ptime& now) {
+    // entries in flight have waiters to answer, and no expiry before their first answer
+    for (auto it = entries.begin(); it != entries.end();) {
+        bool expired = !it->second.in_flight && !it->second.expires.is_not_a_date_time() && it->second.expires <= now;
+        it = expired ? entries.erase(it) : ++it;
+    }
+}
+
+void caching_resolver::async_resolve(const std::string& host, int port, resolve_handler_t handler) {
+    auto key = host + ":" + boost::lexical_cast<std::string>(port);
+    auto now = boost::posix_time::microsec_clock::universal_time();
+
+    boost::mutex::scoped_lock lock(mtx_);
+    sweep(now);
+
+    auto& e = hosts_[key];
+    if (e.in_flight) {
+        e.waiters.push_back(handler);
+        return;
+    }
+
+    if (!e.expires.is_not_a_date_time() && e.expires > now) {
+        auto error = e.error;
+        auto endpoints = e.result;
+        int ttl_sec = (int)(e.expires - now).total_seconds();
+        lock.unlock();
+
+        handler(error, endpoints, ttl_sec);
+        return;
+    }
+
+    e.in_flight = true;
+    e.waiters.push_back(handler);
+    lock.unlock();
+
+    upstream_->async_resolve(host, port, boost::bind(&caching_resolver::handle_resolve, shared_from_this(), key, _1, _2, _3));
+}
+
+void caching_resolver::async_resolve_srv(const std::string& name, srv_handler_t handler) {
+    auto now = boost::posix_time::microsec_clock::universal_time();
+
+    boost::mutex::scoped_lock lock(mtx_);
+    sweep(now);
+
+    auto& e = srvs_[name];
+    if (e.in_flight) {
+        e.waiters.push_back(handler);
+        return;
+    }
+
+    if (!e.expires.is_not_a_date_time() && e.expires > now) {
+        auto error = e.error;
+        auto records = e.result;
+        int ttl_sec = (int)(e.expires - now).total_seconds();
+        lock.unlock();
+
+        handler(error, records, ttl_sec);
+        return;
+    }
+
+    e.in_flight = true;
+    e.waiters.push_back(handler);
+    lock.unlock();
+
+    upstream_->async_resolve_srv(name, boost::bind(&caching_resolver::handle_resolve_srv, shared_from_this(), name, _1, _2, _3));
+}
+
+void caching_resolver::handle_resolve(std::string key, const boost::system::error_code& error, const endpoints_t& endpoints, int ttl_sec) {
+    boost::container::vector<resolve_handler_t> waiters;
+    {
+        boost::mutex::scoped_lock lock(mtx_);
+
+        auto& e = hosts_[key];
+        e.in_flight = false;
+        e.error = error;
+        e.result = endpoints;
+        e.expires = boost::posix_time::microsec_clock::universal_time() + boost::posix_time::seconds(ttl_sec);
+        waiters.swap(e.waiters);
+    }
+
+    for (size_t i = 0; i < waiters.size(); i++) {
+        waiters[i](error, endpoints, ttl_sec);
+    }
+}
+
+void caching_resolver::handle_resolve_srv(std::string key, const boost::system::error_code& error, const srv_records_t& records, int ttl_sec) {
+    boost::container::vector<srv_handler_t> waiters;
+    {
+        boost::mutex::scoped_lock lock(mtx_);
+
+        auto& e = srvs_[key];
+        e.in_flight = false;
+        e.error = error;
+        e.result = records;
+        e.expires = boost::posix_time::microsec_clock::universal_time() + boost::posix_time::seconds(ttl_sec);
+        waiters.swap(e.waiters);
+    }
+
+    for (size_t i = 0; i < waiters.size(); i++) {
+        waiters[i](error, records, ttl_sec);
+    }
+}
@@ -0,0 +1,135 @@
+#ifndef RESOLVER_H
+#define RESOLVER_H
+
+#include <stdint.h>
+#include <string>
+#include <boost/thread.hpp>
+#include <boost/asio.hpp>
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/container/vector.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#define RESOLVER_DEFAULT_TTL_SEC	60
+#define RESOLVER_NEGATIVE_TTL_SEC	5
+#define RESOLVER_DEFAULT_THREADS	4
+#define RESOLVER_SWEEP_SEC	60
+
+typedef boost::container::vector<boost::asio::ip::tcp::endpoint> endpoints_t;
+
+struct srv_record {
+    std::string target;
+    uint16_t port;
+    uint16_t priority;
+    uint16_t weight;
+};
+
+typedef boost::container::vector<srv_record> srv_records_t;
+
+// Handlers may be invoked on any thread; callers wrap them in their strand.
+typedef boost::function<void (const boost::system::error_code&, const endpoints_t&, int ttl_sec)> resolve_handler_t;
+typedef boost::function<void (const boost::system::error_code&, const srv_records_t&, int ttl_sec)> srv_handler_t;
+
+class iresolver {
+public:
+    virtual ~iresolver() {}
+
+    virtual void async_resolve(const std::string& host, int port, resolve_handler_t handler) = 0;
+    virtual void async_resolve_srv(const std::string& name, srv_handler_t handler) = 0;
+};
+
+typedef boost::shared_ptr<iresolver> iresolver_pt;
+
+// Resolves through getaddrinfo and the system's DNS resolver on private
+// worker threads, so blocking lookups never run on a connection's io_service
+// and one slow name does not hold up the others.
+//
+// getaddrinfo does not report record ttls, so address answers are given
+// RESOLVER_DEFAULT_TTL_SEC (RESOLVER_NEGATIVE_TTL_SEC for failures) rather
+// than the ttl the DNS server sent. SRV answers carry their real ttl.
+class system_resolver : public iresolver {
+public:
+    system_resolver(size_t threads = RESOLVER_DEFAULT_THREADS);
+    virtual ~system_resolver();
+
+    virtual void async_resolve(const std::string& host, int port, resolve_handler_t handler);
+    virtual void async_resolve_srv(const std::string& name, srv_handler_t handler);
+
+private:
+    void do_resolve(std::string host, int port, resolve_handler_t handler);
+    void do_resolve_srv(std::string name, srv_handler_t handler);
+
+private:
+    boost::asio::io_service io_service_;
+    boost::shared_ptr<boost::asio::io_service::work> work_;
+    boost::thread_group threads_;
+};
+
+// Answers lookups from a fixed table, for tests against a local server.
+class static_resolver : public iresolver {
+public:
+    void add_host(const std::string& host, const char* ip);
+    void add_srv(const std::string& name, const std::string& target, uint16_t port, uint16_t priority = 0, uint16_t weight = 0);
+
+    virtual void async_resolve(const std::string& host, int port, resolve_handler_t handler);
+    virtual void async_resolve_srv(const std::string& name, srv_handler_t handler);
+
+private:
+    boost::mutex mtx_;
+    boost::unordered_map<std::string, boost::container::vector<boost::asio::ip::address> > hosts_;
+    boost::unordered_map<std::string, srv_records_t> srvs_;
+};
+
+// Caches answers of another resolver until their ttl runs out, and folds
+// concurrent lookups of the same name into one upstream query so a burst of
+// reconnects costs a single round trip. Expired answers are dropped by the
+// lookups, at most once every RESOLVER_SWEEP_SEC.
+class caching_resolver
+    : public iresolver
+    , public boost::enable_shared_from_this<caching_resolver> {
+public:
+    caching_resolver(iresolver_pt upstream);
+
+    virtual void async_resolve(const std::string& host, int port, resolve_handler_t handler);
+    virtual void async_resolve_srv(const std::string& name, srv_handler_t handler);
+
+    void clear();
+
+    // Process wide cache in front of a system_resolver.
+    static iresolver_pt shared();
+
+private:
+    template<typename Result, typename Handler>
+    struct entry {
+        entry() : in_flight(false) {}
+
+        bool in_flight;
+        boost::posix_time::ptime expires;
+        boost::system::error_code error;
+        Result result;
+        boost::container::vector<Handler> waiters;
+    };
+
+    typedef entry<endpoints_t, resolve_handler_t> host_entry_t;
+    typedef entry<srv_records_t, srv_handler_t> srv_entry_t;
+
+    void handle_resolve(std::string key, const boost::system::error_code& error, const endpoints_t& endpoints, int ttl_sec);
+    void handle_resolve_srv(std::string key, const boost::system::error_code& error, const srv_records_t& records, int ttl_sec);
+
+    // Called with mtx_ held.
+    void sweep(const boost::posix_time::ptime& now);
+
+    template<typename Map>
+    static void erase_expired(Map& entries, const boost::posix_time::ptime& now);
+
+private:
+    iresolver_pt upstream_;
+    boost::mutex mtx_;
+    boost::unordered_map<std::string, host_entry_t> hosts_;
+    boost::unordered_map<std::string, srv_entry_t> srvs_;
+    boost::posix_time::ptime next_sweep_;
+};
+
+#endif //RESOLVER_H
@@ -0,0 +1,325 @@
+#include "sasl.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <openssl/hmac.h>
+#include <openssl/rand.h>
+#include <openssl/crypto.h>
+#include <boost/lexical_cast.hpp>
+
+#define SCRAM_NONCE_LEN	18
+#define SCRAM_MIN_ITERATIONS	4096
+
+static const char* sasl_preference[] = { "SCRAM-SHA-256", "SCRAM-SHA-1", "PLAIN" };
+static const char* sasl_plain = "PLAIN";
+
+bool scram_key_cache::find(const std::string& key, scram_keys& keys) {
+    boost::mutex::scoped_lock lock(mtx_);
+
+    auto it = keys_.find(key);
+    if (it == keys_.end()) {
+        return false;
+    }
+
+    keys = it->second;
+    return true;
+}
+
+void scram_key_cache::insert(const std::string& key, const scram_keys& keys) {
+    boost::mutex::scoped_lock lock(mtx_);
+
+    // salts only change on password resets, so a rare full flush is enough
+    if (keys_.size() >= SCRAM_KEY_CACHE_MAX_ENTRIES) {
+        keys_.clear();
+    }
+
+    keys_[key] = keys;
+}
+
+void scram_key_cache::clear() {
+    boost::mutex::scoped_lock lock(mtx_);
+    keys_.clear();
+}
+
+scram_key_cache& scram_key_cache::shared() {
+    static scram_key_cache instance;
+    return instance;
+}
+
+sasl_client::sasl_client(scram_key_cache* cache)
+: cache_(cache)
+, md_(nullptr)
+, state_(idle) {
+}
+
+sasl_client::~sasl_client() {
+    wipe_password();
+}
+
+std::string sasl_client::select(const sasl_mechanisms_t& offered, bool encrypted) {
+    for (size_t i = 0; i < sizeof(sasl_preference) / sizeof(sasl_preference[0]); i++) {
+        if (!encrypted && strcmp(sasl_preference[i], sasl_plain) == 0) {
+            continue;
+        }
+
+        for (size_t j = 0; j < offered.size(); j++) {
+            if (offered[j] == sasl_preference[i]) {
+                return offered[j];
+            }
+        }
+    }
+
+    return std::string();
+}
+
+void sasl_client::set_client_nonce(const std::string& nonce) {
+    client_nonce_ = nonce;
+}
+
+const char* sasl_client::last_error_message() {
+    return last_error_.c_str();
+}
+
+void sasl_client::set_credentials(const char* authcid, const char* password) {
+    wipe_password();
+    authcid_ = authcid;
+    password_ = password;
+}
+
+bool sasl_client::start(const std::string& mechanism, const std::string& authcid, const std::string& password, std::string& initial_response) {
+    wipe_password();
+    authcid_ = authcid;
+    password_ = password;
+    return start(mechanism, initial_response);
+}
+
+bool sasl_client::start(const std::string& mechanism, std::string& initial_response) {
+    mechanism_ = mechanism;
+    const std::string& authcid = authcid_;
+
+    if (mechanism == sasl_plain) {
+        initial_response = std::string(1, '\0') + authcid + std::string(1, '\0') + password_;
+        wipe_password();
+        state_ = plain_sent;
+        return true;
+    }
+
+    if (mechanism == "SCRAM-SHA-256") {
+        md_ = EVP_sha256();
+    } else if (mechanism == "SCRAM-SHA-1") {
+        md_ = EVP_sha1();
+    } else {
+        last_error_ = "unsupported mechanism " + mechanism;
+        wipe_password();
+        return false;
+    }
+
+    if (client_nonce_.empty()) {
+        unsigned char random[SCRAM_NONCE_LEN];
+        if (RAND_bytes(random, sizeof(random)) != 1) {
+            last_error_ = "RAND_bytes failed";
+            wipe_password();
+            return false;
+        }
+        client_nonce_ = base64_encode(std::string((char*)random, sizeof(random)));
+    }
+
+    // saslname escaping, RFC 5802 5.1
+    std::string name;
+    for (size_t i = 0; i < authcid.size(); i++) {
+        if (authcid[i] == '=') {
+            name += "=3D";
+        } else if (authcid[i] == ',') {
+            name += "=2C";
+        } else {
+            name += authcid[i];
+        }
+    }
+
+    client_first_bare_ = "n=" + name + ",r=" + client_nonce_;
+    initial_response = "n,," + client_first_bare_;
+    state_ = scram_first_sent;
+    return true;
+}
+
+bool sasl_client::challenge(const std::string& server_message, std::string& response) {
+    if (state_ == scram_first_sent) {
+        // the only step that needs the password
+        bool ok = scram_client_final(server_message, response);
+        wipe_password();
+        return ok;
+    }
+
+    last_error_ = "unexpected challenge";
+    return false;
+}
+
+bool sasl_client::verify_success(const std::string& server_message) {
+    if (state_ == plain_sent) {
+        state_ = done;
+        return true;
+    }
+
+    if (state_ != scram_final_sent) {
+        last_error_ = "unexpected success";
+        return false;
+    }
+
+    if (server_message.compare(0, 2, "v=") != 0) {
+        last_error_ = "missing server signature";
+        return false;
+    }
+
+    std::string signature;
+    if (!base64_decode(server_message.substr(2), signature) || signature != server_signature_) {
+        last_error_ = "server signature mismatch";
+        return false;
+    }
+
+    state_ = done;
+    return true;
+}
+
+bool sasl_client::scram_client_final(const std::string& server_first, std::string& response) {
+    std::string nonce, salt_b64;
+    int iterations = 0;
+
+    size_t pos = 0;
+    while (pos < server_first.size()) {
+        size_t end = server_first.find(',', pos);
+        if (end == std::string::npos) {
+            end = server_first.size();
+        }
+
+        auto attr = server_first.substr(pos, end - pos);
+        if (attr.size() >= 2 && attr[1] == '=') {
+            auto value = attr.substr(2);
+            switch (attr[0]) {
+                case 'r': nonce = value; break;
+                case 's': salt_b64 = value; break;
+                case 'i': iterations = atoi(value.c_str()); break;
+                case 'm':
+                    last_error_ = "unsupported scram extension";
+                    return false;
+            }
+        }
+        pos = end + 1;
+    }
+
+    std::string salt;
+    if (nonce.compare(0, client_nonce_.size(), client_nonce_) != 0 || nonce.size() == client_nonce_.size()) {
+        last_error_ = "server nonce does not extend client nonce";
+        return false;
+    }
+    if (!base64_decode(salt_b64, salt) || salt.empty()) {
+        last_error_ = "bad salt";
+        return false;
+    }
+    if (iterations < SCRAM_MIN_ITERATIONS) {
+        last_error_ = "iteration count too low";
+        return false;
+    }
+
+    scram_keys keys;
+    derive_keys(salt, iterations, keys);
+
+    auto client_final_without_proof = "c=biws,r=" + nonce;
+    auto auth_message = client_first_bare_ + "," + server_first + "," + client_final_without_proof;
+
+    auto stored_key = digest(keys.client_key);
+    auto client_signature = hmac(stored_key, auth_message);
+
+    std::string proof = keys.client_key;
+    for (size_t i = 0; i < proof.size(); i++) {
+        proof[i] ^= client_signature[i];
+    }
+
+    server_signature_ = hmac(keys.server_key, auth_message);
+
+    response = client_final_without_proof + ",p=" + base64_encode(proof);
+    state_ = scram_final_sent;
+    return true;
+}
+
+void sasl_client::derive_keys(const std::string& salt, int iterations, scram_keys& keys) {
+    // the password only enters the key as a digest, the cache never holds it
+    std::string key = mechanism_ + '\0' + authcid_ + '\0' + salt + '\0' + boost::lexical_cast<std::string>(iterations) + '\0' + digest(password_);
+
+    if (cache_ != nullptr && cache_->find(key, keys)) {
+        return;
+    }
+
+    std::string salted_password(EVP_MD_size(md_), '\0');
+    PKCS5_PBKDF2_HMAC(password_.data(), (int)password_.size(),
+                      (const unsigned char*)salt.data(), (int)salt.size(),
+                      iterations, md_,
+                      (int)salted_password.size(), (unsigned char*)&salted_password[0]);
+
+    keys.client_key = hmac(salted_password, "Client Key");
+    keys.server_key = hmac(salted_password, "Server Key");
+
+    if (cache_ != nullptr) {
+        cache_->insert(key, keys);
+    }
+}
+
+void sasl_client::wipe_password() {
+    if (!password_.empty()) {
+        OPENSSL_cleanse(&password_[0], password_.size());
+    }
+    password_.clear();
+}
+
+std::string sasl_client::hmac(const std::string& key, const std::string& data) {
+    unsigned char out[EVP_MAX_MD_SIZE];
+    unsigned int len = 0;
+
+    HMAC(md_, key.data(), (int)key.size(), (const unsigned char*)data.data(), data.size(), out, &len);
+    return std::string((char*)out, len);
+}
+
+std::string sasl_client::digest(const std::string& data) {
+    unsigned char out[EVP_MAX_MD_SIZE];
+    unsigned int len = 0;
+
+    EVP_Digest(data.data(), data.size(), out, &len, md_ != nullptr ? md_ : EVP_sha256(), nullptr);
+    return std::string((char*)out, len);
+}
+
+std::string sasl_client::base64_encode(const std::string& data) {
+    std::string out(4 * ((data.size() + 2) / 3) + 1, '\0');
+    int len = EVP_EncodeBlock((unsigned char*)&out[0], (const unsigned char*)data.data(), (int)data.size());
+    out.resize(len);
+    return out;
+}
+
+bool sasl_client::base64_decode(const std::string& data, std::string& out) {
+    std::string in;
+    for (size_t i = 0; i < data.size(); i++) {
+        if (!isspace((unsigned char)data[i])) {
+            in += data[i];
+        }
+    }
+
+    if (in.size() % 4 != 0) {
+        return false;
+    }
+
+    out.assign(3 * in.size() / 4 + 1, '\0');
+    int len = EVP_DecodeBlock((unsigned char*)&out[0], (const unsigned char*)in.data(), (int)in.size());
+    if (len < 0) {
+        return false;
+    }
+
+    // EVP_DecodeBlock counts padding as data
+    if (in.size() >= 1 && in[in.size() - 1] == '=') {
+        len--;
+    }
+    if (in.size() >= 2 && in[in.size() - 2] == '=') {
+        len--;
+    }
+
+    out.resize(len);
+    return true;
+}
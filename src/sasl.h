@@ -0,0 +1,95 @@
+#ifndef SASL_H
+#define SASL_H
+
+#include <string>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/container/vector.hpp>
+
+#include <openssl/evp.h>
+
+#define SCRAM_KEY_CACHE_MAX_ENTRIES	16384
+
+typedef boost::container::vector<std::string> sasl_mechanisms_t;
+
+struct scram_keys {
+    std::string client_key;
+    std::string server_key;
+};
+
+// ClientKey/ServerKey derived from a password, keyed by account, hash, salt,
+// iteration count and a digest of the password. The PBKDF2 run behind them is
+// by far the most expensive step of a SCRAM login, and it only depends on
+// those inputs, so reconnecting sessions of the same account skip it.
+class scram_key_cache {
+public:
+    bool find(const std::string& key, scram_keys& keys);
+    void insert(const std::string& key, const scram_keys& keys);
+    void clear();
+
+    static scram_key_cache& shared();
+
+private:
+    boost::mutex mtx_;
+    boost::unordered_map<std::string, scram_keys> keys_;
+};
+
+// Client side of PLAIN, SCRAM-SHA-1 and SCRAM-SHA-256 (RFC 4616, RFC 5802,
+// RFC 7677). Messages in and out are raw; base64 coding for the xmpp
+// <auth/>, <challenge/> and <response/> elements is left to the caller.
+class sasl_client {
+public:
+    sasl_client(scram_key_cache* cache = &scram_key_cache::shared());
+    virtual ~sasl_client();
+
+    // Picks the strongest mechanism offered by the server, empty if none is
+    // supported. PLAIN sends the password in the clear, so it is only picked
+    // on an encrypted transport.
+    static std::string select(const sasl_mechanisms_t& offered, bool encrypted);
+
+    // Copied in once, e.g. at login, so that nobody else needs to hold the
+    // password until the server has offered its mechanisms.
+    void set_credentials(const char* authcid, const char* password);
+
+    // The password is kept only until the exchange no longer needs it, and
+    // wiped on every path, including failures and destruction.
+    bool start(const std::string& mechanism, std::string& initial_response);
+    bool start(const std::string& mechanism, const std::string& authcid, const std::string& password, std::string& initial_response);
+    bool challenge(const std::string& server_message, std::string& response);
+    // Checks the server signature carried by <success/> (SCRAM only).
+    bool verify_success(const std::string& server_message);
+
+    // Fixed client nonce, for test vectors.
+    void set_client_nonce(const std::string& nonce);
+
+    const char* last_error_message();
+
+    static std::string base64_encode(const std::string& data);
+    static bool base64_decode(const std::string& data, std::string& out);
+
+private:
+    bool scram_client_final(const std::string& server_first, std::string& response);
+    void derive_keys(const std::string& salt, int iterations, scram_keys& keys);
+    void wipe_password();
+
+    std::string hmac(const std::string& key, const std::string& data);
+    std::string digest(const std::string& data);
+
+private:
+    enum state_t { idle, plain_sent, scram_first_sent, scram_final_sent, done };
+
+    scram_key_cache* cache_;
+    const EVP_MD* md_;
+    state_t state_;
+
+    std::string mechanism_;
+    std::string authcid_;
+    std::string password_;
+    std::string client_nonce_;
+    std::string client_first_bare_;
+    std::string server_signature_;
+    std::string last_error_;
+};
+
+#endif //SASL_H
@@ -0,0 +1,245 @@
+#ifndef __STANZA_H__
+#define __STANZA_H__
+
+#include <string.h>
+#include <string>
+#include <boost/shared_ptr.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/container/vector.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/foreach.hpp>
+
+class stanza;
+
+typedef boost::shared_ptr<stanza> stanza_pt;
+typedef boost::container::vector<stanza_pt> stanza_children_t;
+typedef boost::unordered_map<std::string, std::string> stanza_attrs_t;
+
+struct stanza_address {
+    std::string to;
+    std::string id;	// left out when empty
+};
+
+typedef boost::container::vector<stanza_address> stanza_addresses_t;
+
+class stanza {
+public:
+    const char* name() {
+        return name_.c_str();
+    }
+
+	static stanza_pt make_stanza() {
+		return boost::make_shared<stanza>();
+	}
+
+	static stanza_pt make_stanza(const char* name) {
+		auto s = boost::make_shared<stanza>();
+		s->set_name(name);
+		return s;
+	}
+
+    void set_name(const char* name) {
+        name_ = name;
+    }
+
+    void set_name(const char* name, size_t len) {
+        name_.assign(name, len);
+    }
+
+    const char* value() {
+        return value_.c_str();
+    }
+
+    void set_value(const char* value) {
+        value_ = value;
+    }
+
+    void set_value(const char* value, size_t len) {
+        value_.assign(value, len);
+    }
+
+    // Takes value over without copying, value gets the previous one.
+    void swap_value(std::string& value) {
+        value_.swap(value);
+    }
+
+    void add_child(stanza_pt stanza) {
+        children_.push_back(stanza);
+    }
+
+    void add_attr(const char* name, const char* value) {
+        attrs_[name] = value;
+    }
+
+    void add_attr(const char* name, size_t name_len, const char* value, size_t value_len) {
+        attrs_[std::string(name, name_len)].assign(value, value_len);
+    }
+
+    const char* get_attr(const char* name) {
+        if (attrs_.find(name) == attrs_.end()) {
+            return nullptr;
+        }
+        return attrs_[name].c_str();
+    }
+
+	bool has_child(const char *child_name, const char *ns) {
+		if (child_name == nullptr) {
+			return false;
+		}
+
+		BOOST_FOREACH(auto s, children_) {
+			if (strcmp(s->name(), child_name) == 0 &&
+				s->get_ns() != nullptr && strcmp(s->get_ns(), ns) == 0) {
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	void get_children(stanza_children_t& results, const char *child_name) {
+		BOOST_FOREACH(auto s, children_) {
+			if (child_name == nullptr || strcmp(s->name(), child_name) == 0) {
+				results.push_back(s);
+			}
+		}
+	}
+
+	stanza_pt get_child(const char *child_name) {
+		BOOST_FOREACH(auto s, children_) {
+			if (strcmp(s->name(), child_name) == 0) {
+				return s;
+			}
+		}
+
+		return stanza_pt();
+	}
+
+	const stanza_attrs_t& attrs() {
+		return attrs_;
+	}
+
+	const stanza_children_t& children() {
+		return children_;
+	}
+
+	const char* get_ns() {
+		return get_attr("xmlns");
+	}
+
+    // Serializes this stanza and its children as xml, appending to out.
+    void to_xml(std::string& out) {
+        to_xml_head(out, false);
+        to_xml_tail(out);
+    }
+
+    // Start tag up to its last attribute, without to and id if skip_address.
+    void to_xml_head(std::string& out, bool skip_address) {
+        out += '<';
+        out += name_;
+
+        BOOST_FOREACH(auto& attr, attrs_) {
+            if (skip_address && (attr.first == "to" || attr.first == "id")) {
+                continue;
+            }
+            out += ' ';
+            out += attr.first;
+            out += "=\"";
+            escape(out, attr.second.data(), attr.second.size());
+            out += '"';
+        }
+    }
+
+    // Everything after the attributes: the end of the start tag, text, children and end tag.
+    void to_xml_tail(std::string& out) {
+        if (children_.empty() && value_.empty()) {
+            out += "/>";
+            return;
+        }
+
+        out += '>';
+        escape(out, value_.data(), value_.size());
+
+        BOOST_FOREACH(auto s, children_) {
+            s->to_xml(out);
+        }
+
+        out += "</";
+        out += name_;
+        out += '>';
+    }
+
+    std::string to_xml() {
+        std::string out;
+        to_xml(out);
+        return out;
+    }
+
+    static void escape(std::string& out, const char* data, size_t len) {
+        for (size_t i = 0; i < len; i++) {
+            switch (data[i]) {
+                case '&': out += "&amp;"; break;
+                case '<': out += "&lt;"; break;
+                case '>': out += "&gt;"; break;
+                case '"': out += "&quot;"; break;
+                case '\'': out += "&apos;"; break;
+                default: out += data[i]; break;
+            }
+        }
+    }
+
+private:
+    std::string name_;
+    std::string value_;
+
+	stanza_children_t children_;
+    stanza_attrs_t attrs_;
+};
+
+// A stanza serialized once with its to and id attributes left open, for sending
+// the same message or presence to many recipients. render() pastes the address
+// between the two shared halves instead of walking the tree again.
+class stanza_template {
+public:
+    stanza_template(stanza_pt s) {
+        s->to_xml_head(head_, true);
+        s->to_xml_tail(tail_);
+    }
+
+    void render(std::string& out, const stanza_address& address) {
+        out += head_;
+        append_attr(out, "to", address.to);
+        append_attr(out, "id", address.id);
+        out += tail_;
+    }
+
+    void render_all(std::string& out, const stanza_addresses_t& addresses) {
+        size_t size = out.size();
+        BOOST_FOREACH(auto& address, addresses) {
+            size += head_.size() + tail_.size() + address.to.size() + address.id.size() + 16;
+        }
+        out.reserve(size);
+
+        BOOST_FOREACH(auto& address, addresses) {
+            render(out, address);
+        }
+    }
+
+private:
+    static void append_attr(std::string& out, const char* name, const std::string& value) {
+        if (value.empty()) {
+            return;
+        }
+        out += ' ';
+        out += name;
+        out += "=\"";
+        stanza::escape(out, value.data(), value.size());
+        out += '"';
+    }
+
+private:
+    std::string head_;
+    std::string tail_;
+};
+
+#endif  // __STANZA_H__
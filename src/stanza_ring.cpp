@@ -0,0 +1,566 @@
+#include "stanza_ring.h"
+
+#include <string.h>
+#include <errno.h>
+
+#define STANZA_RING_RECORD_HEADER	8
+#define STANZA_RING_PAD	0xffffffffu
+#define STANZA_CODEC_MAX_DEPTH	64
+#define STANZA_CODEC_MAX_U16	0xffffu
+#define STANZA_CODEC_MAX_U32	0xffffffffu
+
+#define STANZA_RING_ROUND(n)	(((n) + STANZA_RING_ALIGN - 1) & ~(uint64_t)(STANZA_RING_ALIGN - 1))
+
+static void put_u16(char*& p, size_t v) {
+    uint16_t x = (uint16_t)v;
+    memcpy(p, &x, sizeof(x));
+    p += sizeof(x);
+}
+
+static void put_u32(char*& p, size_t v) {
+    uint32_t x = (uint32_t)v;
+    memcpy(p, &x, sizeof(x));
+    p += sizeof(x);
+}
+
+static void put_bytes(char*& p, const char* v, size_t size) {
+    memcpy(p, v, size);
+    p += size;
+}
+
+static bool get_u16(const char*& p, const char* end, size_t& v) {
+    uint16_t x;
+    if (end - p < (ptrdiff_t)sizeof(x)) {
+        return false;
+    }
+    memcpy(&x, p, sizeof(x));
+    p += sizeof(x);
+    v = x;
+    return true;
+}
+
+static bool get_u32(const char*& p, const char* end, size_t& v) {
+    uint32_t x;
+    if (end - p < (ptrdiff_t)sizeof(x)) {
+        return false;
+    }
+    memcpy(&x, p, sizeof(x));
+    p += sizeof(x);
+    v = x;
+    return true;
+}
+
+size_t stanza_codec::encoded_size(stanza_pt s) {
+    size_t name_len = strlen(s->name());
+    size_t value_len = strlen(s->value());
+
+    if (name_len > STANZA_CODEC_MAX_U16 || value_len > STANZA_CODEC_MAX_U32 ||
+        s->attrs().size() > STANZA_CODEC_MAX_U16 || s->children().size() > STANZA_CODEC_MAX_U16) {
+        return 0;
+    }
+
+    size_t size = 2 + name_len + 2 + 4 + value_len + 2;
+
+    BOOST_FOREACH(auto& attr, s->attrs()) {
+        if (attr.first.size() > STANZA_CODEC_MAX_U16 || attr.second.size() > STANZA_CODEC_MAX_U32) {
+            return 0;
+        }
+        size += 2 + attr.first.size() + 4 + attr.second.size();
+    }
+
+    BOOST_FOREACH(auto child, s->children()) {
+        size_t child_size = encoded_size(child);
+        if (child_size == 0) {
+            return 0;
+        }
+        size += child_size;
+    }
+
+    return size;
+}
+
+size_t stanza_codec::encode(stanza_pt s, char* out) {
+    char* p = out;
+    size_t name_len = strlen(s->name());
+    size_t value_len = strlen(s->value());
+
+    put_u16(p, name_len);
+    put_bytes(p, s->name(), name_len);
+
+    put_u16(p, s->attrs().size());
+    BOOST_FOREACH(auto& attr, s->attrs()) {
+        put_u16(p, attr.first.size());
+        put_bytes(p, attr.first.data(), attr.first.size());
+        put_u32(p, attr.second.size());
+        put_bytes(p, attr.second.data(), attr.second.size());
+    }
+
+    put_u32(p, value_len);
+    put_bytes(p, s->value(), value_len);
+
+    put_u16(p, s->children().size());
+    BOOST_FOREACH(auto child, s->children()) {
+        p += encode(child, p);
+    }
+
+    return p - out;
+}
+
+bool stanza_codec::encode(stanza_pt s, std::string& out) {
+    size_t size = encoded_size(s);
+    if (size == 0) {
+        return false;
+    }
+
+    size_t offset = out.size();
+    out.resize(offset + size);
+    encode(s, &out[offset]);
+    return true;
+}
+
+stanza_pt stanza_codec::decode(const char* data, size_t size) {
+    const char* p = data;
+    stanza_pt s;
+
+    if (!decode(p, data + size, s, 0) || p != data + size) {
+        return stanza_pt();
+    }
+
+    return s;
+}
+
+bool stanza_codec::decode(const char*& p, const char* end, stanza_pt& s, int depth) {
+    size_t len, count;
+
+    if (depth > STANZA_CODEC_MAX_DEPTH || !get_u16(p, end, len) || end - p < (ptrdiff_t)len) {
+        return false;
+    }
+    s = stanza::make_stanza();
+    s->set_name(p, len);
+    p += len;
+
+    if (!get_u16(p, end, count)) {
+        return false;
+    }
+    for (size_t i = 0; i < count; i++) {
+        size_t key_len, value_len;
+        if (!get_u16(p, end, key_len) || end - p < (ptrdiff_t)key_len) {
+            return false;
+        }
+        const char* key = p;
+        p += key_len;
+
+        if (!get_u32(p, end, value_len) || end - p < (ptrdiff_t)value_len) {
+            return false;
+        }
+        s->add_attr(key, key_len, p, value_len);
+        p += value_len;
+    }
+
+    if (!get_u32(p, end, len) || end - p < (ptrdiff_t)len) {
+        return false;
+    }
+    s->set_value(p, len);
+    p += len;
+
+    if (!get_u16(p, end, count)) {
+        return false;
+    }
+    for (size_t i = 0; i < count; i++) {
+        stanza_pt child;
+        if (!decode(p, end, child, depth + 1)) {
+            return false;
+        }
+        s->add_child(child);
+    }
+
+    return true;
+}
+
+#if defined(__linux__)
+
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define STANZA_RING_RELAX()	_mm_pause()
+#else
+#define STANZA_RING_RELAX()
+#endif
+
+stanza_ring::stanza_ring()
+: fd_(-1)
+, header_(nullptr)
+, data_(nullptr)
+, mapped_size_(0)
+, mask_(0)
+, cached_tail_(0)
+, cached_head_(0) {
+    memset(&stats_, 0, sizeof(stats_));
+}
+
+stanza_ring::~stanza_ring() {
+    close();
+}
+
+bool stanza_ring::create(size_t capacity) {
+    close();
+
+    uint64_t size = STANZA_RING_ALIGN * 4;
+    while (size < capacity) {
+        size <<= 1;
+    }
+
+    fd_ = (int)syscall(SYS_memfd_create, "cppnet-stanza-ring", 0);
+    if (fd_ < 0) {
+        last_error_ = std::string("memfd_create: ") + strerror(errno);
+        return false;
+    }
+
+    if (ftruncate(fd_, (off_t)(sizeof(stanza_ring_header) + size)) != 0 || !map(fd_, sizeof(stanza_ring_header) + size)) {
+        if (last_error_.empty()) {
+            last_error_ = std::string("ftruncate: ") + strerror(errno);
+        }
+        close();
+        return false;
+    }
+
+    // a fresh memfd is zero filled, so positions and flags start at 0
+    header_->capacity = size;
+    mask_ = size - 1;
+    __atomic_store_n(&header_->magic, STANZA_RING_MAGIC, __ATOMIC_RELEASE);
+
+    return true;
+}
+
+bool stanza_ring::attach(int fd) {
+    close();
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(stanza_ring_header)) {
+        last_error_ = "not a stanza ring";
+        return false;
+    }
+
+    fd_ = fd;
+    if (!map(fd, st.st_size)) {
+        fd_ = -1;
+        return false;
+    }
+
+    uint64_t capacity = header_->capacity;
+    if (__atomic_load_n(&header_->magic, __ATOMIC_ACQUIRE) != STANZA_RING_MAGIC ||
+        (capacity & (capacity - 1)) != 0 || sizeof(stanza_ring_header) + capacity > mapped_size_) {
+        last_error_ = "not a stanza ring";
+        munmap(header_, mapped_size_);
+        header_ = nullptr;
+        fd_ = -1;
+        return false;
+    }
+
+    mask_ = capacity - 1;
+    cached_head_ = cached_tail_ = __atomic_load_n(&header_->tail, __ATOMIC_ACQUIRE);
+    return true;
+}
+
+void stanza_ring::close() {
+    if (header_ != nullptr) {
+        munmap(header_, mapped_size_);
+        header_ = nullptr;
+        data_ = nullptr;
+        mapped_size_ = 0;
+    }
+
+    if (fd_ >= 0) {
+        ::close(fd_);
+        fd_ = -1;
+    }
+
+    cached_head_ = cached_tail_ = 0;
+}
+
+int stanza_ring::fd() {
+    return fd_;
+}
+
+bool stanza_ring::push(stanza_pt s, int timeout_millisec) {
+    if (header_ == nullptr || is_broken()) {
+        last_error_ = header_ == nullptr ? "ring not open" : "ring broken";
+        return false;
+    }
+
+    uint64_t capacity = mask_ + 1;
+    size_t payload = stanza_codec::encoded_size(s);
+    if (payload == 0) {
+        last_error_ = "stanza field too long for the ring encoding";
+        return false;
+    }
+
+    uint64_t need = STANZA_RING_ROUND(STANZA_RING_RECORD_HEADER + payload);
+    if (need > capacity / 2) {
+        last_error_ = "stanza too large for ring";
+        return false;
+    }
+
+    uint64_t head = header_->head;
+    uint64_t offset = head & mask_;
+    // a record never wraps, the rest of the ring is skipped instead
+    uint64_t skip = capacity - offset < need ? capacity - offset : 0;
+
+    while (head + skip + need - cached_tail_ > capacity) {
+        cached_tail_ = __atomic_load_n(&header_->tail, __ATOMIC_ACQUIRE);
+        if (head + skip + need - cached_tail_ <= capacity) {
+            break;
+        }
+        if (!wait(&header_->producer_waiting, &header_->tail, cached_tail_, timeout_millisec)) {
+            last_error_ = is_broken() ? "ring broken" : "ring full";
+            return false;
+        }
+    }
+
+    if (skip != 0) {
+        *(uint32_t*)(data_ + offset) = STANZA_RING_PAD;
+        head += skip;
+        offset = 0;
+    }
+
+    *(uint32_t*)(data_ + offset) = (uint32_t)payload;
+    stanza_codec::encode(s, data_ + offset + STANZA_RING_RECORD_HEADER);
+
+    __atomic_store_n(&header_->head, head + need, __ATOMIC_RELEASE);
+    wake(&header_->consumer_waiting);
+
+    stats_.records++;
+    stats_.bytes += payload;
+    return true;
+}
+
+stanza_pt stanza_ring::pop(int timeout_millisec) {
+    if (header_ == nullptr || is_broken()) {
+        return stanza_pt();
+    }
+
+    uint64_t capacity = mask_ + 1;
+    uint64_t tail = header_->tail;
+
+    for (;;) {
+        while (tail == cached_head_) {
+            cached_head_ = __atomic_load_n(&header_->head, __ATOMIC_ACQUIRE);
+            if (tail != cached_head_) {
+                break;
+            }
+            if (!wait(&header_->consumer_waiting, &header_->head, tail, timeout_millisec)) {
+                return stanza_pt();
+            }
+        }
+
+        // everything below comes from the other process, trust none of it
+        uint64_t available = cached_head_ - tail;
+        uint64_t offset = tail & mask_;
+        uint32_t size = *(const uint32_t*)(data_ + offset);
+
+        if (available > capacity) {
+            mark_broken("head out of range");
+            return stanza_pt();
+        }
+
+        if (size == STANZA_RING_PAD) {
+            if (capacity - offset > available) {
+                mark_broken("padding past head");
+                return stanza_pt();
+            }
+            tail += capacity - offset;
+            continue;
+        }
+
+        uint64_t need = STANZA_RING_ROUND(STANZA_RING_RECORD_HEADER + (uint64_t)size);
+        if (need > capacity / 2 || need > capacity - offset || need > available) {
+            mark_broken("record size out of range");
+            return stanza_pt();
+        }
+
+        auto s = stanza_codec::decode(data_ + offset + STANZA_RING_RECORD_HEADER, size);
+        if (s == nullptr) {
+            mark_broken("malformed record");
+            return stanza_pt();
+        }
+
+        __atomic_store_n(&header_->tail, tail + need, __ATOMIC_RELEASE);
+        wake(&header_->producer_waiting);
+
+        stats_.records++;
+        stats_.bytes += size;
+        return s;
+    }
+}
+
+bool stanza_ring::is_broken() {
+    return header_ != nullptr && __atomic_load_n(&header_->broken, __ATOMIC_ACQUIRE) != 0;
+}
+
+stanza_ring_stats stanza_ring::stats() {
+    return stats_;
+}
+
+const char* stanza_ring::last_error_message() {
+    return last_error_.c_str();
+}
+
+void stanza_ring::mark_broken(const char* reason) {
+    last_error_ = std::string("ring broken: ") + reason;
+    __atomic_store_n(&header_->broken, 1, __ATOMIC_RELEASE);
+
+    // a peer asleep on the ring finds out when it wakes
+    wake(&header_->producer_waiting);
+    wake(&header_->consumer_waiting);
+}
+
+bool stanza_ring::map(int fd, size_t size) {
+    auto base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+        last_error_ = std::string("mmap: ") + strerror(errno);
+        return false;
+    }
+
+    header_ = (stanza_ring_header*)base;
+    data_ = (char*)base + sizeof(stanza_ring_header);
+    mapped_size_ = size;
+    return true;
+}
+
+// Spins for a while, then flags waiting and sleeps until the peer moves
+// *position or the timeout passes. False on timeout.
+bool stanza_ring::wait(uint32_t* waiting, const uint64_t* position, uint64_t unchanged, int timeout_millisec) {
+    for (int i = 0; i < STANZA_RING_SPIN; i++) {
+        if (__atomic_load_n(position, __ATOMIC_ACQUIRE) != unchanged) {
+            return true;
+        }
+        STANZA_RING_RELAX();
+    }
+
+    if (is_broken()) {
+        return false;
+    }
+
+    if (timeout_millisec == 0) {
+        return false;
+    }
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeout_millisec / 1000;
+    deadline.tv_nsec += (timeout_millisec % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    for (;;) {
+        // the flag must be visible before the position is checked again, or the
+        // peer could move it and skip the wake in between
+        __atomic_store_n(waiting, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(position, __ATOMIC_SEQ_CST) != unchanged) {
+            __atomic_store_n(waiting, 0, __ATOMIC_RELAXED);
+            return true;
+        }
+
+        struct timespec ts;
+        if (timeout_millisec > 0) {
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            ts.tv_sec = deadline.tv_sec - now.tv_sec;
+            ts.tv_nsec = deadline.tv_nsec - now.tv_nsec;
+            if (ts.tv_nsec < 0) {
+                ts.tv_sec--;
+                ts.tv_nsec += 1000000000L;
+            }
+            if (ts.tv_sec < 0) {
+                __atomic_store_n(waiting, 0, __ATOMIC_RELAXED);
+                return false;
+            }
+        }
+
+        // shared futex, the peer is another process; wakes may be spurious
+        syscall(SYS_futex, waiting, FUTEX_WAIT, 1, timeout_millisec < 0 ? nullptr : &ts, nullptr, 0);
+        __atomic_store_n(waiting, 0, __ATOMIC_RELAXED);
+
+        if (__atomic_load_n(position, __ATOMIC_ACQUIRE) != unchanged) {
+            return true;
+        }
+        if (is_broken()) {
+            return false;
+        }
+    }
+}
+
+void stanza_ring::wake(uint32_t* waiting) {
+    // pairs with the seq_cst flag store and position load in wait()
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(waiting, __ATOMIC_RELAXED) == 0) {
+        return;
+    }
+
+    __atomic_store_n(waiting, 0, __ATOMIC_RELAXED);
+    syscall(SYS_futex, waiting, FUTEX_WAKE, 1, nullptr, nullptr, 0);
+    stats_.wakeups++;
+}
+
+#else
+
+stanza_ring::stanza_ring()
+: fd_(-1)
+, header_(nullptr)
+, data_(nullptr)
+, mapped_size_(0)
+, mask_(0)
+, cached_tail_(0)
+, cached_head_(0) {
+    memset(&stats_, 0, sizeof(stats_));
+}
+
+stanza_ring::~stanza_ring() {
+}
+
+bool stanza_ring::create(size_t capacity) {
+    last_error_ = "stanza rings need Linux";
+    return false;
+}
+
+bool stanza_ring::attach(int fd) {
+    last_error_ = "stanza rings need Linux";
+    return false;
+}
+
+void stanza_ring::close() {
+}
+
+int stanza_ring::fd() {
+    return fd_;
+}
+
+bool stanza_ring::push(stanza_pt s, int timeout_millisec) {
+    return false;
+}
+
+stanza_pt stanza_ring::pop(int timeout_millisec) {
+    return stanza_pt();
+}
+
+bool stanza_ring::is_broken() {
+    return false;
+}
+
+stanza_ring_stats stanza_ring::stats() {
+    return stats_;
+}
+
+const char* stanza_ring::last_error_message() {
+    return last_error_.c_str();
+}
+
+#endif
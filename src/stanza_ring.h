@@ -0,0 +1,115 @@
+#ifndef STANZA_RING_H
+#define STANZA_RING_H
+
+#include <stdint.h>
+#include <string>
+#include <boost/shared_ptr.hpp>
+
+#include "stanza.h"
+
+#define STANZA_RING_MAGIC	0x31525343	// "CSR1"
+#define STANZA_RING_ALIGN	64
+#define STANZA_RING_DEFAULT_CAPACITY	(4 * 1024 * 1024)
+#define STANZA_RING_SPIN	2000
+
+// Compact binary form of a stanza, little endian:
+//   u16 name length, name, u16 attr count, { u16 key length, key, u32 value length, value },
+//   u32 text length, text, u16 child count, children
+// Strings are copied straight between the stanza and the encoding.
+class stanza_codec {
+public:
+    // 0 if a name, key, text or count does not fit its length field.
+    static size_t encoded_size(stanza_pt s);
+    // out must have room for encoded_size(s) bytes, returns the bytes written.
+    static size_t encode(stanza_pt s, char* out);
+    static bool encode(stanza_pt s, std::string& out);
+    // Null if data is not a complete encoding.
+    static stanza_pt decode(const char* data, size_t size);
+
+private:
+    static bool decode(const char*& p, const char* end, stanza_pt& s, int depth);
+};
+
+// Producer and consumer positions live on cache lines of their own, so the
+// two processes only share a line when one of them is about to sleep.
+struct stanza_ring_header {
+    uint32_t magic;
+    uint32_t broken;	// set by a side that found a record it cannot trust
+    uint64_t capacity;
+
+    alignas(STANZA_RING_ALIGN) uint64_t head;
+    uint32_t consumer_waiting;
+
+    alignas(STANZA_RING_ALIGN) uint64_t tail;
+    uint32_t producer_waiting;
+};
+
+struct stanza_ring_stats {
+    uint64_t records;
+    uint64_t bytes;
+    uint64_t wakeups;	// futex wakes issued, zero while the peer keeps up
+};
+
+// Single producer, single consumer ring of encoded stanzas in a memfd, for
+// handing parsed stanzas from the io process to a worker process. Records
+// start on cache line boundaries; the producer encodes straight into the ring
+// and the consumer decodes out of it, so a stanza's strings are copied once
+// each way.
+//
+// The consumer checks every record against the ring bounds, as the peer is
+// another process. One that does not fit marks the ring broken and both sides
+// fail from then on.
+//
+// Neither side makes a syscall while the other keeps up: a side only sleeps
+// on a futex in the shared mapping after spinning, and is only woken if it
+// flagged that it sleeps.
+//
+// Linux only; create() and attach() fail elsewhere.
+class stanza_ring {
+public:
+    stanza_ring();
+    virtual ~stanza_ring();
+
+    // Producer side. capacity is rounded up to a power of two.
+    bool create(size_t capacity = STANZA_RING_DEFAULT_CAPACITY);
+    // Consumer side, with the fd of create() inherited over fork or passed with SCM_RIGHTS.
+    bool attach(int fd);
+    void close();
+
+    int fd();
+
+    // Waits up to timeout_millisec for room, false if there is none, s is
+    // larger than half the ring or does not fit the encoding.
+    bool push(stanza_pt s, int timeout_millisec = 0);
+    // Null if nothing arrives within timeout_millisec, negative waits forever,
+    // or if the ring is broken.
+    stanza_pt pop(int timeout_millisec = -1);
+    bool is_broken();
+
+    stanza_ring_stats stats();
+    const char* last_error_message();
+
+private:
+    bool map(int fd, size_t size);
+    bool wait(uint32_t* waiting, const uint64_t* position, uint64_t unchanged, int timeout_millisec);
+    void wake(uint32_t* waiting);
+    void mark_broken(const char* reason);
+
+private:
+    int fd_;
+    stanza_ring_header* header_;
+    char* data_;
+    size_t mapped_size_;
+    uint64_t mask_;
+
+    // each side's cached copy of the other's position
+    uint64_t cached_tail_;
+    uint64_t cached_head_;
+
+    stanza_ring_stats stats_;
+    std::string last_error_;
+};
+
+typedef boost::shared_ptr<stanza_ring> stanza_ring_pt;
+
+#endif //STANZA_RING_H
@@ -0,0 +1,197 @@
+#include "trace.h"
+
+#include <stdio.h>
+#include <fstream>
+#include <algorithm>
+#include <boost/thread/mutex.hpp>
+#include <boost/container/vector.hpp>
+#include <boost/chrono.hpp>
+
+// Only the owning thread writes a slot. seq is odd while it does and 2n + 2
+// once record n is complete, so an exporter racing with the writer can tell a
+// torn or overwritten slot and skip it.
+struct trace_slot {
+    boost::atomic<uint64_t> seq;
+    boost::atomic<uint64_t> tsc;
+    boost::atomic<const void*> context;
+    boost::atomic<uint32_t> point;
+    boost::atomic<uint32_t> arg;
+};
+
+class trace_ring {
+public:
+    trace_ring(uint32_t tid) : tid(tid), head(0), cleared(0) {
+        for (size_t i = 0; i < TRACE_RING_SIZE; i++) {
+            slots[i].seq.store(0, boost::memory_order_relaxed);
+        }
+    }
+
+    uint32_t tid;
+    boost::atomic<uint64_t> head;
+    // records before this one were cleared, only clear() writes it
+    boost::atomic<uint64_t> cleared;
+    trace_slot slots[TRACE_RING_SIZE];
+};
+
+struct trace_point_desc {
+    const char* name;
+    const char* phase;
+};
+
+static const trace_point_desc trace_point_descs[TRACE_POINT_COUNT] = {
+    { "socket_read", "i" },
+    { "parse", "B" },
+    { "parse", "E" },
+    { "stanza_complete", "i" },
+    { "dispatch", "B" },
+    { "dispatch", "E" },
+    { "write_queued", "i" },
+    { "write_completed", "i" },
+};
+
+// rings outlive their threads so a late export still sees their records
+static boost::mutex rings_mtx;
+static boost::container::vector<trace_ring*> rings;
+
+static thread_local trace_ring* thread_ring = nullptr;
+
+static boost::atomic<uint64_t> calibration_tsc(0);
+static boost::atomic<uint64_t> calibration_nanosec(0);
+
+boost::atomic<bool> trace::enabled_(false);
+
+void trace::enable(bool on) {
+    if (on) {
+        boost::mutex::scoped_lock lock(rings_mtx);
+
+        if (calibration_tsc.load(boost::memory_order_relaxed) == 0) {
+            calibration_nanosec.store(steady_nanosec(), boost::memory_order_relaxed);
+            calibration_tsc.store(now(), boost::memory_order_release);
+        }
+    }
+    enabled_.store(on, boost::memory_order_release);
+}
+
+uint64_t trace::steady_nanosec() {
+    return boost::chrono::duration_cast<boost::chrono::nanoseconds>(boost::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+trace_ring* trace::create_local_ring() {
+    boost::mutex::scoped_lock lock(rings_mtx);
+
+    thread_ring = new trace_ring((uint32_t)rings.size() + 1);
+    rings.push_back(thread_ring);
+
+    return thread_ring;
+}
+
+void trace::record(trace_point point, const void* context, uint32_t arg) {
+    auto ring = thread_ring;
+    if (ring == nullptr) {
+        ring = create_local_ring();
+    }
+    auto head = ring->head.load(boost::memory_order_relaxed);
+
+    auto& slot = ring->slots[head & (TRACE_RING_SIZE - 1)];
+    slot.seq.store(head * 2 + 1, boost::memory_order_relaxed);
+    boost::atomic_thread_fence(boost::memory_order_release);
+
+    slot.tsc.store(now(), boost::memory_order_relaxed);
+    slot.context.store(context, boost::memory_order_relaxed);
+    slot.point.store(point, boost::memory_order_relaxed);
+    slot.arg.store(arg, boost::memory_order_relaxed);
+
+    slot.seq.store(head * 2 + 2, boost::memory_order_release);
+    ring->head.store(head + 1, boost::memory_order_release);
+}
+
+// Reads record n of ring, false if its slot is being written or already holds a later record.
+static bool read_record(trace_ring* ring, uint64_t n, trace_record& r) {
+    auto& slot = ring->slots[n & (TRACE_RING_SIZE - 1)];
+
+    if (slot.seq.load(boost::memory_order_acquire) != n * 2 + 2) {
+        return false;
+    }
+
+    r.tsc = slot.tsc.load(boost::memory_order_relaxed);
+    r.context = slot.context.load(boost::memory_order_relaxed);
+    r.point = slot.point.load(boost::memory_order_relaxed);
+    r.arg = slot.arg.load(boost::memory_order_relaxed);
+
+    boost::atomic_thread_fence(boost::memory_order_acquire);
+    return slot.seq.load(boost::memory_order_relaxed) == n * 2 + 2;
+}
+
+void trace::clear() {
+    boost::mutex::scoped_lock lock(rings_mtx);
+
+    for (size_t i = 0; i < rings.size(); i++) {
+        rings[i]->cleared.store(rings[i]->head.load(boost::memory_order_acquire), boost::memory_order_relaxed);
+    }
+}
+
+void trace::write_chrome_json(std::ostream& out) {
+    // ticks per microsecond, measured over the whole time since enable()
+    double ticks_per_usec = 1000.0;
+    uint64_t start_tsc = calibration_tsc.load(boost::memory_order_acquire);
+#if defined(__x86_64__) || defined(__i386__)
+    uint64_t elapsed_nanosec = steady_nanosec() - calibration_nanosec.load(boost::memory_order_relaxed);
+    uint64_t elapsed_ticks = now() - start_tsc;
+    if (elapsed_nanosec > 0 && elapsed_ticks > 0) {
+        ticks_per_usec = (double)elapsed_ticks * 1000.0 / (double)elapsed_nanosec;
+    }
+#endif
+
+    boost::container::vector<trace_ring*> snapshot;
+    {
+        boost::mutex::scoped_lock lock(rings_mtx);
+        snapshot = rings;
+    }
+
+    out << "{\"traceEvents\":[";
+
+    bool first = true;
+    char line[256];
+
+    for (size_t i = 0; i < snapshot.size(); i++) {
+        auto ring = snapshot[i];
+        uint64_t head = ring->head.load(boost::memory_order_acquire);
+        uint64_t begin = head > TRACE_RING_SIZE ? head - TRACE_RING_SIZE : 0;
+        begin = std::max(begin, ring->cleared.load(boost::memory_order_relaxed));
+
+        for (uint64_t n = begin; n < head; n++) {
+            trace_record r;
+            if (!read_record(ring, n, r) || r.point >= TRACE_POINT_COUNT || r.tsc < start_tsc) {
+                continue;
+            }
+
+            auto& desc = trace_point_descs[r.point];
+            double ts = (double)(r.tsc - start_tsc) / ticks_per_usec;
+
+            snprintf(line, sizeof(line),
+                     "%s\n{\"name\":\"%s\",\"ph\":\"%s\",%s\"ts\":%.3f,\"pid\":1,\"tid\":%u,\"args\":{\"conn\":\"%p\",\"arg\":%u}}",
+                     first ? "" : ",",
+                     desc.name,
+                     desc.phase,
+                     desc.phase[0] == 'i' ? "\"s\":\"t\"," : "",
+                     ts,
+                     ring->tid,
+                     r.context,
+                     r.arg);
+            out << line;
+            first = false;
+        }
+    }
+
+    out << "\n],\"displayTimeUnit\":\"ns\"}\n";
+}
+
+bool trace::export_chrome_json(const char* path) {
+    std::ofstream out(path, std::ios::out | std::ios::trunc);
+    if (!out.is_open()) {
+        return false;
+    }
+
+    write_chrome_json(out);
+    return out.good();
+}
@@ -0,0 +1,85 @@
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <ostream>
+#include <boost/atomic.hpp>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// Hot path trace points, recorded into per-thread ring buffers and exported as
+// Chrome trace / Perfetto JSON. Build with CPPNET_TRACE defined to compile them
+// in, then switch recording on with trace::enable(true). Without CPPNET_TRACE
+// every TRACE_POINT expands to nothing.
+//
+// The context of every point is the connection's iprotocol, so the socket,
+// parse and dispatch events of one connection share one "conn" in the export.
+
+#define TRACE_RING_SIZE	65536
+
+enum trace_point {
+    TRACE_SOCKET_READ = 0,
+    TRACE_PARSE_BEGIN,
+    TRACE_PARSE_END,
+    TRACE_STANZA_COMPLETE,
+    TRACE_DISPATCH_BEGIN,
+    TRACE_DISPATCH_END,
+    TRACE_WRITE_QUEUED,
+    TRACE_WRITE_COMPLETED,
+    TRACE_POINT_COUNT
+};
+
+struct trace_record {
+    uint64_t tsc;
+    const void* context;
+    uint32_t point;
+    uint32_t arg;
+};
+
+class trace_ring;
+
+class trace {
+public:
+    static void enable(bool on);
+
+    static bool enabled() {
+        return enabled_.load(boost::memory_order_relaxed);
+    }
+
+    static uint64_t now() {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        return steady_nanosec();
+#endif
+    }
+
+    static void record(trace_point point, const void* context, uint32_t arg);
+
+    // Writes everything still held in the rings; safe while recording continues,
+    // records being overwritten meanwhile are skipped rather than torn.
+    static void write_chrome_json(std::ostream& out);
+    static bool export_chrome_json(const char* path);
+
+    // Hides what was recorded so far from later exports, also while recording.
+    static void clear();
+
+private:
+    static uint64_t steady_nanosec();
+    static trace_ring* create_local_ring();
+
+private:
+    static boost::atomic<bool> enabled_;
+};
+
+#ifdef CPPNET_TRACE
+#define TRACE_POINT(point, context, arg) \
+    do { if (trace::enabled()) trace::record((point), (context), (uint32_t)(arg)); } while (0)
+#else
+#define TRACE_POINT(point, context, arg) do {} while (0)
+#endif
+
+#endif  // __TRACE_H__
@@ -0,0 +1,635 @@
+#include "uring_transport.h"
+
+#include <string.h>
+#include <errno.h>
+#include <boost/bind.hpp>
+
+#if defined(__linux__)
+
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#define URING_OP_RECV	1
+#define URING_OP_SEND	2
+#define URING_OP_CANCEL	3
+#define URING_OP_PROVIDE	4
+
+#define URING_USER_DATA(id, op)	(((uint64_t)(id) << 8) | (op))
+
+static int uring_setup(unsigned entries, io_uring_params* params) {
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0);
+}
+
+uring_transport::uring_transport(unsigned entries, unsigned buffer_count, size_t buffer_size)
+: entries_(entries)
+, buffer_count_(buffer_count)
+, buffer_size_(buffer_size)
+, ring_fd_(-1)
+, ring_(nullptr)
+, ring_size_(0)
+, sqes_(nullptr)
+, sqes_size_(0)
+, sq_local_tail_(0)
+, sq_pending_(0)
+, buffers_(nullptr)
+, multishot_(false)
+, next_id_(0)
+, current_id_(0)
+, flush_posted_(false)
+, in_completions_(false)
+, enter_calls_(0)
+, submitted_(0)
+, completed_(0) {
+}
+
+uring_transport::~uring_transport() {
+    close();
+}
+
+bool uring_transport::open() {
+    if (ring_fd_ >= 0) {
+        return true;
+    }
+
+    if (buffer_count_ == 0 || buffer_count_ > 65536) {
+        last_error_ = "buffer count must be within 1..65536";
+        return false;
+    }
+
+    // multishot receives post many completions per request
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = entries_ * 4;
+
+    ring_fd_ = uring_setup(entries_, &params);
+    if (ring_fd_ < 0) {
+        last_error_ = std::string("io_uring_setup: ") + strerror(errno);
+        return false;
+    }
+
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_NODROP)) {
+        last_error_ = "io_uring lacks single mmap or nodrop";
+        unmap();
+        return false;
+    }
+
+    size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cq_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    ring_size_ = sq_size > cq_size ? sq_size : cq_size;
+
+    auto ring = mmap(nullptr, ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+    if (ring == MAP_FAILED) {
+        last_error_ = std::string("mmap: ") + strerror(errno);
+        ring_size_ = 0;
+        unmap();
+        return false;
+    }
+    ring_ = ring;
+
+    sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+    auto sqes = mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        last_error_ = std::string("mmap: ") + strerror(errno);
+        sqes_size_ = 0;
+        unmap();
+        return false;
+    }
+    sqes_ = (io_uring_sqe*)sqes;
+
+    auto base = (char*)ring_;
+    sq_head_ = (unsigned*)(base + params.sq_off.head);
+    sq_tail_ = (unsigned*)(base + params.sq_off.tail);
+    sq_array_ = (unsigned*)(base + params.sq_off.array);
+    sq_flags_ = (unsigned*)(base + params.sq_off.flags);
+    sq_mask_ = *(unsigned*)(base + params.sq_off.ring_mask);
+    sq_entries_ = params.sq_entries;
+    sq_local_tail_ = *sq_tail_;
+    sq_pending_ = 0;
+
+    cq_head_ = (unsigned*)(base + params.cq_off.head);
+    cq_tail_ = (unsigned*)(base + params.cq_off.tail);
+    cq_mask_ = *(unsigned*)(base + params.cq_off.ring_mask);
+    cqes_ = (io_uring_cqe*)(base + params.cq_off.cqes);
+    sq_backlog_.clear();
+
+    multishot_ = probe_multishot();
+
+    // receive buffers the kernel picks from, handed back after each completion
+    auto buffers = mmap(nullptr, buffer_count_ * buffer_size_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buffers == MAP_FAILED) {
+        last_error_ = std::string("mmap: ") + strerror(errno);
+        unmap();
+        return false;
+    }
+    buffers_ = (char*)buffers;
+
+    auto sqe = get_sqe();
+    sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+    sqe->fd = (int)buffer_count_;
+    sqe->addr = (uint64_t)(uintptr_t)buffers_;
+    sqe->len = (unsigned)buffer_size_;
+    sqe->buf_group = URING_BUFFER_GROUP;
+    sqe->off = 0;
+    sqe->user_data = URING_USER_DATA(0, URING_OP_PROVIDE);
+
+    int res;
+    if (!submit_and_wait(res)) {
+        unmap();
+        return false;
+    }
+    if (res < 0) {
+        last_error_ = std::string("IORING_OP_PROVIDE_BUFFERS: ") + strerror(-res);
+        unmap();
+        return false;
+    }
+
+    io_service_ = boost::shared_ptr<boost::asio::io_service>(new boost::asio::io_service());
+    work_ = boost::shared_ptr<boost::asio::io_service::work>(new boost::asio::io_service::work(*io_service_));
+    ring_descriptor_ = boost::shared_ptr<boost::asio::posix::stream_descriptor>(new boost::asio::posix::stream_descriptor(*io_service_, ring_fd_));
+
+    wait_completions();
+
+    t_ = boost::thread(boost::bind(static_cast<size_t (boost::asio::io_service::*)()>(&boost::asio::io_service::run), io_service_));
+
+    return true;
+}
+
+void uring_transport::close() {
+    if (io_service_ != nullptr) {
+        work_.reset();
+        io_service_->stop();
+        if (t_.joinable()) {
+            t_.join();
+        }
+
+        // the ring fd is closed below together with its mappings
+        ring_descriptor_->release();
+        ring_descriptor_.reset();
+    }
+
+    connections_.clear();
+    unmap();
+}
+
+bool uring_transport::is_open() {
+    return ring_fd_ >= 0 && io_service_ != nullptr;
+}
+
+boost::shared_ptr<boost::asio::io_service> uring_transport::get_io_service() {
+    return io_service_;
+}
+
+uint32_t uring_transport::attach(int fd, uring_recv_handler_t handler) {
+    if (!is_open()) {
+        return 0;
+    }
+
+    // ids live in the upper bits of user_data, 0 is never handed out
+    do {
+        next_id_ = (next_id_ + 1) & 0xffffff;
+    } while (next_id_ == 0 || connections_.find(next_id_) != connections_.end());
+
+    auto& c = connections_[next_id_];
+    c.fd = fd;
+    c.closing = false;
+    c.recv_active = false;
+    c.send_active = false;
+    c.recv_handler = handler;
+    c.send_data = nullptr;
+    c.send_size = 0;
+    c.send_offset = 0;
+
+    prep_recv(next_id_, c);
+    schedule_flush();
+
+    return next_id_;
+}
+
+void uring_transport::detach(uint32_t id) {
+    auto it = connections_.find(id);
+    if (it == connections_.end() || it->second.closing) {
+        return;
+    }
+
+    auto& c = it->second;
+    c.closing = true;
+
+    // the entry stays until the kernel is done with it, a handler may be running
+    if (c.recv_active) {
+        auto sqe = get_sqe();
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd = -1;
+        sqe->addr = URING_USER_DATA(id, URING_OP_RECV);
+        sqe->user_data = URING_USER_DATA(id, URING_OP_CANCEL);
+        schedule_flush();
+    } else if (!c.send_active && id != current_id_) {
+        connections_.erase(it);
+    }
+}
+
+bool uring_transport::send(uint32_t id, const char* data, size_t size, uring_send_handler_t handler) {
+    auto it = connections_.find(id);
+    if (it == connections_.end() || it->second.closing || it->second.send_active) {
+        return false;
+    }
+
+    auto& c = it->second;
+    c.send_handler = handler;
+    c.send_data = data;
+    c.send_size = size;
+    c.send_offset = 0;
+
+    prep_send(id, c);
+    schedule_flush();
+
+    return true;
+}
+
+uring_transport_stats uring_transport::stats() {
+    uring_transport_stats stats;
+    stats.enter_calls = enter_calls_.load(boost::memory_order_relaxed);
+    stats.submitted = submitted_.load(boost::memory_order_relaxed);
+    stats.completed = completed_.load(boost::memory_order_relaxed);
+    return stats;
+}
+
+const char* uring_transport::last_error_message() {
+    return last_error_.c_str();
+}
+
+bool uring_transport::multishot() {
+    return multishot_;
+}
+
+io_uring_sqe* uring_transport::get_sqe() {
+    if (sq_backlog_.empty() && sq_local_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) >= sq_entries_) {
+        flush();
+    }
+
+    // the kernel did not take the full ring (EBUSY, EAGAIN), queue behind it in order
+    if (!sq_backlog_.empty() || sq_local_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) >= sq_entries_) {
+        sq_backlog_.push_back(io_uring_sqe());
+        memset(&sq_backlog_.back(), 0, sizeof(io_uring_sqe));
+        return &sq_backlog_.back();
+    }
+
+    unsigned index = sq_local_tail_ & sq_mask_;
+    sq_array_[index] = index;
+    sq_local_tail_++;
+    sq_pending_++;
+
+    auto sqe = &sqes_[index];
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+// Only used from open(), with nothing else in flight.
+bool uring_transport::submit_and_wait(int& res) {
+    __atomic_store_n(sq_tail_, sq_local_tail_, __ATOMIC_RELEASE);
+    sq_pending_ = 0;
+    if (uring_enter(ring_fd_, 1, 1, IORING_ENTER_GETEVENTS) != 1) {
+        last_error_ = std::string("io_uring_enter: ") + strerror(errno);
+        return false;
+    }
+
+    unsigned head = *cq_head_;
+    res = cqes_[head & cq_mask_].res;
+    __atomic_store_n(cq_head_, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+// Kernels before 6.0 reject IORING_RECV_MULTISHOT with EINVAL. A receive on a
+// socket whose peer is gone completes at once, and with no buffer provided yet
+// it takes none.
+bool uring_transport::probe_multishot() {
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+        return false;
+    }
+    ::close(fds[1]);
+
+    auto sqe = get_sqe();
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fds[0];
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUFFER_GROUP;
+    sqe->user_data = URING_USER_DATA(0, URING_OP_RECV);
+
+    int res;
+    bool supported = submit_and_wait(res) && res != -EINVAL;
+    ::close(fds[0]);
+
+    return supported;
+}
+
+void uring_transport::prep_recv(uint32_t id, connection& c) {
+    auto sqe = get_sqe();
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = c.fd;
+    // single shot otherwise, handle_recv re-arms it after each completion
+    sqe->ioprio = multishot_ ? IORING_RECV_MULTISHOT : 0;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUFFER_GROUP;
+    sqe->user_data = URING_USER_DATA(id, URING_OP_RECV);
+
+    c.recv_active = true;
+}
+
+void uring_transport::prep_send(uint32_t id, connection& c) {
+    auto sqe = get_sqe();
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = c.fd;
+    sqe->addr = (uint64_t)(uintptr_t)(c.send_data + c.send_offset);
+    sqe->len = (unsigned)(c.send_size - c.send_offset);
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = URING_USER_DATA(id, URING_OP_SEND);
+
+    c.send_active = true;
+}
+
+void uring_transport::handle_recv(connections_t::iterator it, const io_uring_cqe& cqe) {
+    auto& c = it->second;
+    bool more = (cqe.flags & IORING_CQE_F_MORE) != 0;
+    bool has_buffer = (cqe.flags & IORING_CQE_F_BUFFER) != 0;
+    uint16_t bid = (uint16_t)(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+
+    if (!more) {
+        c.recv_active = false;
+    }
+
+    if (c.closing) {
+        if (has_buffer) {
+            recycle_buffer(bid);
+        }
+        return;
+    }
+
+    if (cqe.res > 0) {
+        c.recv_handler(boost::system::error_code(), buffers_ + (size_t)bid * buffer_size_, (size_t)cqe.res);
+        recycle_buffer(bid);
+
+        if (!more && !c.closing) {
+            prep_recv(it->first, c);
+        }
+    } else if (cqe.res == -ENOBUFS) {
+        // every buffer was taken within one batch, they go back ahead of this
+        if (!more) {
+            prep_recv(it->first, c);
+        }
+    } else if (cqe.res == 0) {
+        c.closing = true;
+        c.recv_handler(boost::asio::error::eof, nullptr, 0);
+    } else {
+        c.closing = true;
+        c.recv_handler(boost::system::error_code(-cqe.res, boost::system::system_category()), nullptr, 0);
+    }
+}
+
+void uring_transport::handle_send(connections_t::iterator it, const io_uring_cqe& cqe) {
+    auto& c = it->second;
+    c.send_active = false;
+
+    if (c.closing) {
+        return;
+    }
+
+    if (cqe.res >= 0) {
+        c.send_offset += cqe.res;
+        if (c.send_offset < c.send_size && cqe.res > 0) {
+            prep_send(it->first, c);
+            return;
+        }
+    }
+
+    // the handler may start the next send
+    uring_send_handler_t handler;
+    handler.swap(c.send_handler);
+
+    if (cqe.res < 0) {
+        handler(boost::system::error_code(-cqe.res, boost::system::system_category()), c.send_offset);
+    } else if (c.send_offset < c.send_size) {
+        handler(boost::asio::error::connection_reset, c.send_offset);
+    } else {
+        handler(boost::system::error_code(), c.send_offset);
+    }
+}
+
+void uring_transport::recycle_buffer(uint16_t bid) {
+    // goes out with the next batch, ahead of any recv re-armed after it
+    auto sqe = get_sqe();
+    sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+    sqe->fd = 1;
+    sqe->addr = (uint64_t)(uintptr_t)(buffers_ + (size_t)bid * buffer_size_);
+    sqe->len = (unsigned)buffer_size_;
+    sqe->buf_group = URING_BUFFER_GROUP;
+    sqe->off = bid;
+    sqe->user_data = URING_USER_DATA(0, URING_OP_PROVIDE);
+
+    schedule_flush();
+}
+
+void uring_transport::schedule_flush() {
+    // handle_completions flushes once at the end of its batch
+    if (flush_posted_ || in_completions_) {
+        return;
+    }
+
+    flush_posted_ = true;
+    io_service_->post(boost::bind(&uring_transport::flush, this));
+}
+
+void uring_transport::flush() {
+    flush_posted_ = false;
+
+    for (;;) {
+        // entries queued behind a full ring move in as the kernel frees slots
+        while (!sq_backlog_.empty() && sq_local_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) < sq_entries_) {
+            unsigned index = sq_local_tail_ & sq_mask_;
+            sqes_[index] = sq_backlog_.front();
+            sq_array_[index] = index;
+            sq_local_tail_++;
+            sq_pending_++;
+            sq_backlog_.pop_front();
+        }
+
+        if (sq_pending_ == 0) {
+            return;
+        }
+
+        __atomic_store_n(sq_tail_, sq_local_tail_, __ATOMIC_RELEASE);
+
+        int submitted = uring_enter(ring_fd_, sq_pending_, 0, 0);
+        enter_calls_.fetch_add(1, boost::memory_order_relaxed);
+
+        if (submitted < 0) {
+            // EAGAIN/EBUSY: out of kernel resources or completions, the entries
+            // stay queued and handle_completions retries after draining
+            if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+                last_error_ = std::string("io_uring_enter: ") + strerror(errno);
+            }
+            return;
+        }
+
+        sq_pending_ -= submitted;
+        submitted_.fetch_add(submitted, boost::memory_order_relaxed);
+
+        if (sq_backlog_.empty() || submitted == 0) {
+            return;
+        }
+    }
+}
+
+void uring_transport::wait_completions() {
+    ring_descriptor_->async_read_some(boost::asio::null_buffers(),
+                                      boost::bind(&uring_transport::handle_completions, this, boost::asio::placeholders::error));
+}
+
+void uring_transport::handle_completions(const boost::system::error_code& error) {
+    if (error) {
+        return;
+    }
+
+    in_completions_ = true;
+
+    unsigned head = *cq_head_;
+    unsigned tail;
+    while (head != (tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE))) {
+        for (; head != tail; head++) {
+            io_uring_cqe cqe = cqes_[head & cq_mask_];
+            // hand the slot back before running handlers
+            __atomic_store_n(cq_head_, head + 1, __ATOMIC_RELEASE);
+            completed_.fetch_add(1, boost::memory_order_relaxed);
+
+            uint32_t id = (uint32_t)(cqe.user_data >> 8);
+            int op = (int)(cqe.user_data & 0xff);
+
+            auto it = connections_.find(id);
+            if (it == connections_.end()) {
+                if (op == URING_OP_RECV && (cqe.flags & IORING_CQE_F_BUFFER)) {
+                    recycle_buffer((uint16_t)(cqe.flags >> IORING_CQE_BUFFER_SHIFT));
+                }
+                continue;
+            }
+
+            current_id_ = id;
+            if (op == URING_OP_RECV) {
+                handle_recv(it, cqe);
+            } else if (op == URING_OP_SEND) {
+                handle_send(it, cqe);
+            }
+            current_id_ = 0;
+
+            auto& c = it->second;
+            if (c.closing && !c.recv_active && !c.send_active) {
+                connections_.erase(it);
+            }
+        }
+
+        // completions that did not fit the CQ wait in the kernel (and make it
+        // refuse submissions with EBUSY) until an enter with GETEVENTS
+        if (__atomic_load_n(sq_flags_, __ATOMIC_ACQUIRE) & IORING_SQ_CQ_OVERFLOW) {
+            uring_enter(ring_fd_, 0, 0, IORING_ENTER_GETEVENTS);
+            enter_calls_.fetch_add(1, boost::memory_order_relaxed);
+        }
+    }
+
+    in_completions_ = false;
+
+    flush();
+    if (sq_pending_ != 0 || !sq_backlog_.empty()) {
+        schedule_flush();
+    }
+
+    wait_completions();
+}
+
+void uring_transport::unmap() {
+    if (buffers_ != nullptr) {
+        munmap(buffers_, buffer_count_ * buffer_size_);
+        buffers_ = nullptr;
+    }
+
+    if (sqes_ != nullptr) {
+        munmap(sqes_, sqes_size_);
+        sqes_ = nullptr;
+    }
+
+    if (ring_ != nullptr) {
+        munmap(ring_, ring_size_);
+        ring_ = nullptr;
+    }
+
+    if (ring_fd_ >= 0) {
+        ::close(ring_fd_);
+        ring_fd_ = -1;
+    }
+
+    io_service_.reset();
+}
+
+#else
+
+uring_transport::uring_transport(unsigned entries, unsigned buffer_count, size_t buffer_size)
+: entries_(entries)
+, buffer_count_(buffer_count)
+, buffer_size_(buffer_size)
+, ring_fd_(-1)
+, next_id_(0)
+, enter_calls_(0)
+, submitted_(0)
+, completed_(0) {
+}
+
+uring_transport::~uring_transport() {
+}
+
+bool uring_transport::open() {
+    last_error_ = "io_uring needs Linux";
+    return false;
+}
+
+void uring_transport::close() {
+}
+
+bool uring_transport::is_open() {
+    return false;
+}
+
+boost::shared_ptr<boost::asio::io_service> uring_transport::get_io_service() {
+    return io_service_;
+}
+
+uint32_t uring_transport::attach(int fd, uring_recv_handler_t handler) {
+    return 0;
+}
+
+void uring_transport::detach(uint32_t id) {
+}
+
+bool uring_transport::send(uint32_t id, const char* data, size_t size, uring_send_handler_t handler) {
+    return false;
+}
+
+uring_transport_stats uring_transport::stats() {
+    uring_transport_stats stats = { 0, 0, 0 };
+    return stats;
+}
+
+const char* uring_transport::last_error_message() {
+    return last_error_.c_str();
+}
+
+bool uring_transport::multishot() {
+    return false;
+}
+
+#endif
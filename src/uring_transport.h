@@ -0,0 +1,152 @@
+#ifndef URING_TRANSPORT_H
+#define URING_TRANSPORT_H
+
+#include <stdint.h>
+#include <string>
+#include <boost/asio.hpp>
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+#include <boost/atomic.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/container/deque.hpp>
+
+#define URING_DEFAULT_ENTRIES	256
+#define URING_DEFAULT_BUFFERS	256
+#define URING_DEFAULT_BUFFER_SIZE	8192
+#define URING_BUFFER_GROUP	1
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+typedef boost::function<void (const boost::system::error_code&, char*, size_t)> uring_recv_handler_t;
+typedef boost::function<void (const boost::system::error_code&, size_t)> uring_send_handler_t;
+
+struct uring_transport_stats {
+    uint64_t enter_calls;
+    uint64_t submitted;
+    uint64_t completed;
+};
+
+// Linux io_uring backend for plain TCP connections. One ring and one thread
+// serve every attached connection: receives are multishot into a group of
+// buffers provided to the kernel up front, and everything queued while
+// handling a batch of completions, including handing consumed buffers back,
+// goes to the kernel with a single io_uring_enter.
+//
+// attach, detach and send must be called on the transport thread, that is from
+// handlers running on get_io_service(). No other thread runs that io_service,
+// so handlers are serialized just as a strand would do.
+//
+// Needs Linux 5.7: open() sets up the ring with IORING_SETUP_CQSIZE, requires
+// the single mmap and nodrop features, and hands the receive buffers over with
+// IORING_OP_PROVIDE_BUFFERS; any of these missing, or another system, makes it
+// fail. It then probes for IORING_RECV_MULTISHOT (Linux 6.0) with a receive on
+// a socket pair whose peer is closed. Where that is rejected, a single-shot
+// receive is re-armed after every completion instead.
+class uring_transport {
+public:
+    uring_transport(unsigned entries = URING_DEFAULT_ENTRIES, unsigned buffer_count = URING_DEFAULT_BUFFERS, size_t buffer_size = URING_DEFAULT_BUFFER_SIZE);
+    virtual ~uring_transport();
+
+    bool open();
+    // Not from the transport thread.
+    void close();
+    bool is_open();
+
+    boost::shared_ptr<boost::asio::io_service> get_io_service();
+
+    // Starts receiving on fd, handler gets data that is only valid during the call.
+    // Returns 0 if the transport is not open.
+    uint32_t attach(int fd, uring_recv_handler_t handler);
+    // Stops receiving, no handler of id runs afterwards. fd may be closed right away.
+    void detach(uint32_t id);
+    // One send in flight per connection; data must stay valid until handler runs.
+    bool send(uint32_t id, const char* data, size_t size, uring_send_handler_t handler);
+
+    uring_transport_stats stats();
+    const char* last_error_message();
+    bool multishot();
+
+private:
+    struct connection {
+        int fd;
+        bool closing;
+        bool recv_active;
+        bool send_active;
+        uring_recv_handler_t recv_handler;
+        uring_send_handler_t send_handler;
+        const char* send_data;
+        size_t send_size;
+        size_t send_offset;
+    };
+
+    typedef boost::unordered_map<uint32_t, connection> connections_t;
+
+    io_uring_sqe* get_sqe();
+    bool submit_and_wait(int& res);
+    bool probe_multishot();
+    void prep_recv(uint32_t id, connection& c);
+    void prep_send(uint32_t id, connection& c);
+    void handle_recv(connections_t::iterator it, const io_uring_cqe& cqe);
+    void handle_send(connections_t::iterator it, const io_uring_cqe& cqe);
+    void recycle_buffer(uint16_t bid);
+
+    void schedule_flush();
+    void flush();
+    void wait_completions();
+    void handle_completions(const boost::system::error_code& error);
+
+    void unmap();
+
+private:
+    unsigned entries_;
+    unsigned buffer_count_;
+    size_t buffer_size_;
+
+    int ring_fd_;
+    void* ring_;
+    size_t ring_size_;
+    io_uring_sqe* sqes_;
+    size_t sqes_size_;
+
+    unsigned* sq_head_;
+    unsigned* sq_tail_;
+    unsigned* sq_array_;
+    unsigned* sq_flags_;
+    unsigned sq_mask_;
+    unsigned sq_entries_;
+    unsigned sq_local_tail_;
+    unsigned sq_pending_;
+    // prepared while the ring was full and the kernel would not take more
+    boost::container::deque<io_uring_sqe> sq_backlog_;
+
+    unsigned* cq_head_;
+    unsigned* cq_tail_;
+    unsigned cq_mask_;
+    io_uring_cqe* cqes_;
+
+    char* buffers_;
+    bool multishot_;
+
+    connections_t connections_;
+    uint32_t next_id_;
+    uint32_t current_id_;
+    bool flush_posted_;
+    bool in_completions_;
+
+    boost::shared_ptr<boost::asio::io_service> io_service_;
+    boost::shared_ptr<boost::asio::io_service::work> work_;
+    boost::shared_ptr<boost::asio::posix::stream_descriptor> ring_descriptor_;
+    boost::thread t_;
+
+    boost::atomic<uint64_t> enter_calls_;
+    boost::atomic<uint64_t> submitted_;
+    boost::atomic<uint64_t> completed_;
+
+    std::string last_error_;
+};
+
+typedef boost::shared_ptr<uring_transport> uring_transport_pt;
+
+#endif //URING_TRANSPORT_H
@@ -1,11 +1,34 @@
 #include "xml_parser.h"
+#include <stdlib.h>
 #include <iostream>
 
 using namespace std;
 
+// room in front of every expat allocation for its size, keeps malloc's alignment
+#define XML_PARSER_MEM_HEADER	16
+
+// expat's allocator has no user data, so calls into expat name the parser to charge
+static thread_local xml_parser *accounted_parser = nullptr;
+
+struct accounting_scope {
+    accounting_scope(xml_parser *parser) : previous(accounted_parser) {
+        accounted_parser = parser;
+    }
+    ~accounting_scope() {
+        accounted_parser = previous;
+    }
+    xml_parser *previous;
+};
+
 xml_parser::xml_parser()
     : parser_(nullptr)
-    , depth_(0) {
+    , depth_(0)
+    , namespace_separator_(0)
+    , allocated_(0)
+    , compacted_size_(0)
+    , fed_(0)
+    , event_end_(0)
+    , boundary_(false) {
 }
 
 xml_parser::~xml_parser() {
@@ -15,25 +38,51 @@ xml_parser::~xml_parser() {
 bool xml_parser::init(const XML_Char *encoding, const XML_Char *namespace_separator) {
     deinit();
     
-    parser_ = XML_ParserCreate_MM(encoding, nullptr, namespace_separator);
+    if (encoding != nullptr) {
+        encoding_ = encoding;
+    } else {
+        encoding_.clear();
+    }
+    namespace_separator_ = namespace_separator != nullptr ? *namespace_separator : 0;
+    
+    if (!create()) {
+        return false;
+    }
+    
+    set_handlers(true);
+    
+    return true;
+}
+
+bool xml_parser::create() {
+    static const XML_Memory_Handling_Suite memsuite = { mem_malloc, mem_realloc, mem_free };
+    accounting_scope scope(this);
+    
+    parser_ = XML_ParserCreate_MM(encoding_.empty() ? nullptr : encoding_.c_str(), &memsuite, namespace_separator_ != 0 ? &namespace_separator_ : nullptr);
     if (parser_ == nullptr) {
         return false;
     }
     
     XML_SetUserData(parser_, (void *)this);
-    XML_SetStartElementHandler(parser_, start_element);
-    XML_SetEndElementHandler(parser_, end_element);
-    XML_SetCharacterDataHandler(parser_, visit_data);
+    compacted_size_ = allocated_;
+    fed_ = 0;
+    event_end_ = 0;
+    boundary_ = false;
     
     return true;
 }
 
+void xml_parser::set_handlers(bool enable) {
+    XML_SetStartElementHandler(parser_, enable ? start_element : nullptr);
+    XML_SetEndElementHandler(parser_, enable ? end_element : nullptr);
+    XML_SetCharacterDataHandler(parser_, enable ? visit_data : nullptr);
+}
+
 void xml_parser::deinit() {
     if (parser_ != nullptr) {
-        XML_SetStartElementHandler(parser_, nullptr);
-        XML_SetEndElementHandler(parser_, nullptr);
-        XML_SetCharacterDataHandler(parser_, nullptr);
+        set_handlers(false);
 
+        accounting_scope scope(this);
         XML_ParserFree(parser_);
         parser_ = nullptr;
     }
@@ -52,17 +101,62 @@ bool xml_parser::parse(const char *buffer, int length, bool is_final) {
         length = (int)strlen(buffer);
     }
     
-    void *buff = (char*)XML_GetBuffer(parser_, 1024);
+    accounting_scope scope(this);
+    
+    void *buff = (char*)XML_GetBuffer(parser_, length);
+    if (buff == nullptr) {
+        return false;
+    }
+
     memcpy(buff, buffer, length);
     
     auto ret = XML_ParseBuffer(parser_, length, is_final);
     if (ret != XML_STATUS_OK) {
         auto error_code = XML_GetErrorCode(parser_);
         
+        cout << "XML_Parse error. Error code is " << error_code << ", " << XML_ErrorString(error_code) << endl;
+        boundary_ = false;
+        return false;
+    }
+    
+    // whatever expat has not reported yet is at the end of this buffer if it fits
+    fed_ += length;
+    XML_Index pending = fed_ - event_end_;
+    boundary_ = pending <= length;
+    for (const char *p = buffer + length - pending; boundary_ && p < buffer + length; p++) {
+        boundary_ = *p == ' ' || *p == '\t' || *p == '\r' || *p == '\n';
+    }
+    
+    return true;
+}
+
+size_t xml_parser::memory_footprint() {
+    return allocated_;
+}
+
+bool xml_parser::can_compact() {
+    return parser_ != nullptr && boundary_ && allocated_ >= compacted_size_ + XML_PARSER_COMPACT_SLACK;
+}
+
+bool xml_parser::compact(const char *reopen, int length) {
+    deinit();
+    if (!create()) {
+        return false;
+    }
+    
+    accounting_scope scope(this);
+    
+    if (XML_Parse(parser_, reopen, length, false) != XML_STATUS_OK) {
+        auto error_code = XML_GetErrorCode(parser_);
+        
         cout << "XML_Parse error. Error code is " << error_code << ", " << XML_ErrorString(error_code) << endl;
         return false;
     }
     
+    set_handlers(true);
+    fed_ = event_end_ = length;
+    compacted_size_ = allocated_;
+    
     return true;
 }
 
@@ -101,6 +195,7 @@ void xml_parser::on_end_element(const XML_Char *name) {
 void xml_parser::start_element(void *data, const XML_Char *name, const XML_Char **attrs) {
     auto parser = (xml_parser*)data;
     
+    parser->update_position();
     parser->on_start_element(name, attrs);
 }
 
@@ -114,6 +209,64 @@ void xml_parser::visit_data(void *data, const XML_Char *s, int len) {
 void xml_parser::end_element(void *data, const XML_Char *name) {
     auto parser = (xml_parser*)data;
     
+    parser->update_position();
     parser->on_end_element(name);
 
 }
+
+void xml_parser::update_position() {
+    // the end tag of an empty element reports no bytes of its own
+    XML_Index end = XML_GetCurrentByteIndex(parser_) + XML_GetCurrentByteCount(parser_);
+    if (end > event_end_) {
+        event_end_ = end;
+    }
+}
+
+void* xml_parser::mem_malloc(size_t size) {
+    char *p = (char*)malloc(size + XML_PARSER_MEM_HEADER);
+    if (p == nullptr) {
+        return nullptr;
+    }
+    
+    *(size_t*)p = size;
+    if (accounted_parser != nullptr) {
+        accounted_parser->allocated_ += size;
+    }
+    
+    return p + XML_PARSER_MEM_HEADER;
+}
+
+void* xml_parser::mem_realloc(void *ptr, size_t size) {
+    if (ptr == nullptr) {
+        return mem_malloc(size);
+    }
+    
+    char *p = (char*)ptr - XML_PARSER_MEM_HEADER;
+    size_t old_size = *(size_t*)p;
+    
+    p = (char*)realloc(p, size + XML_PARSER_MEM_HEADER);
+    if (p == nullptr) {
+        return nullptr;
+    }
+    
+    *(size_t*)p = size;
+    if (accounted_parser != nullptr) {
+        accounted_parser->allocated_ -= old_size;
+        accounted_parser->allocated_ += size;
+    }
+    
+    return p + XML_PARSER_MEM_HEADER;
+}
+
+void xml_parser::mem_free(void *ptr) {
+    if (ptr == nullptr) {
+        return;
+    }
+    
+    char *p = (char*)ptr - XML_PARSER_MEM_HEADER;
+    if (accounted_parser != nullptr) {
+        accounted_parser->allocated_ -= *(size_t*)p;
+    }
+    
+    free(p);
+}
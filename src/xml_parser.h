@@ -5,6 +5,9 @@
 #define XML_STATIC
 
 #include <expat.h>
+#include <string>
+
+#define XML_PARSER_COMPACT_SLACK	4096
 
 class xml_parser {
 public:
@@ -16,6 +19,18 @@ public:
     
     bool parse(const char *buffer, int length = -1, bool is_final = true);
     
+    // Bytes expat has allocated for this parser.
+    size_t memory_footprint();
+    
+protected:
+    // True after parse() if expat holds no partial token, at most trailing
+    // whitespace, and has grown XML_PARSER_COMPACT_SLACK bytes or more since it
+    // was created.
+    bool can_compact();
+    // Recreates the parser to give back the buffers expat grew for past input,
+    // then feeds it reopen, the start tags still open, with the handlers off so
+    // parsing goes on as before.
+    bool compact(const char *reopen, int length);
     
 public:
     virtual void on_start_element(const XML_Char *name, const XML_Char **attrs);
@@ -26,12 +41,29 @@ private:
     static void XMLCALL start_element(void *data, const XML_Char *name, const XML_Char **attrs);
     static void XMLCALL visit_data(void *data, const XML_Char *s, int len);
     static void XMLCALL end_element(void *data, const XML_Char *name);
+    
+    static void* XMLCALL mem_malloc(size_t size);
+    static void* XMLCALL mem_realloc(void *ptr, size_t size);
+    static void XMLCALL mem_free(void *ptr);
+    
+    bool create();
+    void set_handlers(bool enable);
+    void update_position();
 
 protected:
     int depth_;
 
 private:
     XML_Parser parser_;
+    std::basic_string<XML_Char> encoding_;
+    XML_Char namespace_separator_;
+    
+    size_t allocated_;
+    size_t compacted_size_;
+    // stream offsets of the input fed so far and of the end of the last event
+    XML_Index fed_;
+    XML_Index event_end_;
+    bool boundary_;
 };
 
 
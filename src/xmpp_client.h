@@ -0,0 +1,470 @@
+#ifndef __XMPP_CLIENT_H__
+#define __XMPP_CLIENT_H__
+
+#include "network_client.h"
+#include "xmpp_protocol.h"
+#include "stanza.h"
+#include "iq_tracker.h"
+#include "sasl.h"
+
+#include <stdio.h>
+#include <boost/thread/future.hpp>
+#include <boost/container/deque.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <openssl/crypto.h>
+
+#define IQ_SWEEP_MILLISEC	100
+
+enum xmpp_client_status {
+    XMPP_STATUS_NONE = 0,
+    XMPP_STATUS_AUTHENTICATING,
+    XMPP_STATUS_AUTHENTICATED,
+    XMPP_STATUS_AUTH_FAILED,
+};
+
+typedef boost::function<void (stanza_pt)> stanza_handler_t;
+
+// Create with boost::make_shared: the connection and the iq timer keep the
+// session alive until stop() or a disconnect.
+class xmpp_client : public xmpp_handler, public boost::enable_shared_from_this<xmpp_client> {
+public:
+    xmpp_client()
+    : protocol_(nullptr)
+    , nc_(nullptr)
+    , pooled_receive_(false)
+    , iq_timer_armed_(false)
+    , stanza_waiting_(false)
+    , status_(XMPP_STATUS_NONE) {
+        mtx_ = boost::make_shared<boost::mutex>();
+    }
+    
+    virtual ~xmpp_client() {
+    }
+
+	virtual void on_sasl(stanza_pt s) {
+		if (status_ == XMPP_STATUS_AUTHENTICATING) {
+			handle_sasl(s);
+			return;
+		}
+		if (deliver_stanza(s)) {
+			return;
+		}
+		printf("on_sasl...\n");
+	}
+
+	virtual void on_message(stanza_pt s) {
+		if (deliver_stanza(s)) {
+			return;
+		}
+		printf("on_message...\n");
+	}
+
+	virtual void on_iq(stanza_pt s) {
+		if (deliver_stanza(s)) {
+			return;
+		}
+		printf("on_iq...\n");
+	}
+
+	virtual void on_presence(stanza_pt s) {
+		if (deliver_stanza(s)) {
+			return;
+		}
+		printf("on_presence...\n");
+	}
+
+	virtual void on_unhandled_stanza(stanza_pt s) {
+		if (deliver_stanza(s)) {
+			return;
+		}
+		printf("on_unhandled_stanza...%s\n", s->name());
+	}
+    
+    bool start(const char* ip, int port) {
+        if (!async_start(ip, port)) {
+            printf("Connection failed!\nLast Error: %d, %s\n", nc_->last_error_code(), nc_->last_error_message());
+            return false;
+        }
+        
+        if (!nc_->wait_connected(10000)) {
+            printf("Connection timeout!\nLast Error: %d, %s\n", nc_->last_error_code(), nc_->last_error_message());
+            return false;
+        }
+        
+        return true;
+    }
+    
+    // Connects without blocking; handler runs on the io strand when done.
+    bool async_start(const char* host, int port, connect_handler_t handler = connect_handler_t(), bool use_srv = false) {
+        if (protocol_ == nullptr) {
+            protocol_ = boost::make_shared<xmpp_protocol>();
+			protocol_->set_xmpp_handler(this);
+			protocol_->set_iq_tracker(&iq_tracker_);
+			protocol_->set_compact_parser(pooled_receive_);
+        }
+        
+        if (nc_ == nullptr) {
+            nc_ = boost::make_shared<network_client>(protocol_.get());
+            if (io_service_ != nullptr) {
+                nc_->set_io_service(io_service_);
+            }
+            nc_->set_pooled_receive(pooled_receive_);
+        }
+        
+        if (iq_timer_ == nullptr) {
+            iq_timer_ = boost::make_shared<boost::asio::deadline_timer>(*nc_->get_io_service());
+        }
+        
+        // the protocol calls back into this object from the connection's handlers
+        nc_->set_owner(shared_from_this());
+        if (!nc_->connect(host, port, use_srv, handler)) {
+            if (!nc_->is_connected()) {
+                nc_->set_owner(boost::shared_ptr<void>());
+            }
+            return false;
+        }
+        
+        return true;
+    }
+    
+    // Hands the next inbound stanza that is not an iq reply to handler instead of
+    // the on_* callbacks. Stanzas arriving while nobody waits are queued once
+    // this has been called.
+    void async_next_stanza(stanza_handler_t handler) {
+        stanza_pt s;
+        {
+            auto_lock lock(mtx_);
+            
+            stanza_waiting_ = true;
+            if (stanza_queue_.empty()) {
+                stanza_handler_ = handler;
+                return;
+            }
+            
+            s = stanza_queue_.front();
+            stanza_queue_.pop_front();
+        }
+        
+        handler(s);
+    }
+    
+    // Places the connection on an io_service run elsewhere, e.g. io_engine::pick(jid).
+    // Set before start.
+    void set_io_service(io_service_pt io_service) {
+        io_service_ = io_service;
+    }
+    
+    // For many mostly idle sessions: no receive buffer and no grown parser
+    // buffers are kept between stanzas, see network_client::set_pooled_receive.
+    // Set before start.
+    void set_pooled_receive(bool enable) {
+        pooled_receive_ = enable;
+    }
+    
+    // Bytes held by the session right now, connection and parser included.
+    size_t memory_footprint() {
+        size_t size = sizeof(*this);
+        
+        if (nc_ != nullptr) {
+            size += nc_->memory_footprint();
+        }
+        if (protocol_ != nullptr) {
+            size += sizeof(xmpp_protocol) + protocol_->memory_footprint();
+        }
+        
+        return size;
+    }
+    
+    network_client* network() {
+        return nc_.get();
+    }
+    
+    void stop() {
+        if (nc_ == nullptr) {
+            return;
+        }
+        
+        nc_->close();
+        boost::atomic_store(&sasl_, boost::shared_ptr<sasl_client>());
+        // the timer belongs to the io thread, its aborted handler releases us
+        if (iq_timer_armed_) {
+            nc_->get_io_service()->post(boost::bind(&xmpp_client::cancel_iq_timer, iq_timer_));
+        }
+        iq_tracker_.cancel_all(boost::system::errc::make_error_code(boost::system::errc::operation_canceled));
+        
+        // wake up a waiting async_next_stanza with a null stanza
+        stanza_handler_t handler;
+        {
+            auto_lock lock(mtx_);
+            handler.swap(stanza_handler_);
+        }
+        if (handler) {
+            handler(stanza_pt());
+        }
+    }
+    
+    // Sends an iq without waiting for replies to earlier ones. The id attribute is
+    // assigned here; callback runs on the io thread with the result or error iq,
+    // or with a null stanza and timed_out once timeout_millisec has passed.
+    bool send_iq(stanza_pt iq, iq_callback_t callback, int timeout_millisec = 10000) {
+        if (nc_ == nullptr || iq_timer_ == nullptr) {
+            return false;
+        }
+        
+        std::string id;
+        auto seq = iq_tracker_.add(callback, timeout_millisec, id, iq->get_attr("to"));
+        iq->add_attr("id", id.c_str());
+        
+        std::string data;
+        iq->to_xml(data);
+        
+        if (!nc_->write(const_cast<char*>(data.c_str()), data.size())) {
+            iq_tracker_.remove(seq);
+            return false;
+        }
+        
+        if (!iq_timer_armed_.exchange(true)) {
+            nc_->get_io_service()->post(boost::bind(&xmpp_client::arm_iq_timer, shared_from_this()));
+        }
+        
+        return true;
+    }
+    
+    // Same as above, but the reply is delivered through a future. Timeouts and
+    // disconnects surface as a boost::system::system_error from get().
+    boost::unique_future<stanza_pt> send_iq(stanza_pt iq, int timeout_millisec = 10000) {
+        auto promise = boost::make_shared<boost::promise<stanza_pt> >();
+        auto future = promise->get_future();
+        
+        if (!send_iq(iq, boost::bind(&xmpp_client::complete_iq_promise, promise, _1, _2), timeout_millisec)) {
+            promise->set_exception(boost::copy_exception(boost::system::system_error(boost::system::errc::make_error_code(boost::system::errc::not_connected))));
+        }
+        
+        return boost::move(future);
+    }
+    
+    // Serializes stanzas back to back and hands them to the network as one write.
+    // handler, if given, runs once the whole batch has been written.
+    bool send_batch(const stanza_children_t& stanzas, write_handler_t handler = write_handler_t()) {
+        if (nc_ == nullptr) {
+            return false;
+        }
+        
+        auto data = boost::make_shared<std::string>();
+        BOOST_FOREACH(auto s, stanzas) {
+            s->to_xml(*data);
+        }
+        
+        return nc_->write(data, handler);
+    }
+    
+    // Fan-out of one stanza: s is serialized once and only to/id change per
+    // recipient, all of it going out as one write. Any to/id already on s is ignored.
+    bool send_to_many(stanza_pt s, const stanza_addresses_t& addresses, write_handler_t handler = write_handler_t()) {
+        if (nc_ == nullptr) {
+            return false;
+        }
+        
+        auto data = boost::make_shared<std::string>();
+        stanza_template(s).render_all(*data, addresses);
+        
+        return nc_->write(data, handler);
+    }
+    
+    // Opens the stream and authenticates with the strongest SASL mechanism the
+    // server offers. Completion shows up in status().
+    bool login(const char* id, const char* host, const char* password) {
+        id_ = id;
+        host_ = host;
+        iq_tracker_.set_account((id_ + "@" + host_).c_str(), host_.c_str());
+        
+        // only the sasl client holds the password, and wipes it once used or dropped
+        auto sasl = boost::make_shared<sasl_client>();
+        sasl->set_credentials(id, password);
+        boost::atomic_store(&sasl_, sasl);
+        status_ = XMPP_STATUS_AUTHENTICATING;
+        
+        return send_stream_header();
+    }
+    
+    int status() {
+        return status_;
+    }
+    
+    const char* jid() {
+        return (std::string(id_) + "@" + std::string(host_)).c_str();
+    }
+
+private:
+    bool send_stream_header() {
+        std::string data = "<?xml version=\"1.0\"?><stream:stream xmlns=\"jabber:client\" xmlns:stream=\"http://etherx.jabber.org/streams\" to=\"" + host_ + "\" version=\"1.0\">\n";
+        
+        return nc_->write(const_cast<char*>(data.c_str()), data.size());
+    }
+    
+    void handle_sasl(stanza_pt s) {
+        // stop() may drop it from another thread
+        auto sasl = boost::atomic_load(&sasl_);
+        if (sasl == nullptr) {
+            return;
+        }
+        
+        std::string name = s->name();
+        std::string in, out;
+        
+        if (name == "stream:features") {
+            sasl_mechanisms_t offered;
+            stanza_children_t mechanisms;
+            s->get_child("mechanisms")->get_children(mechanisms, "mechanism");
+            BOOST_FOREACH(auto m, mechanisms) {
+                offered.push_back(m->value());
+            }
+            
+            // without TLS an offered PLAIN is ignored rather than sending the password in the clear
+            auto mechanism = sasl_client::select(offered, nc_->is_encrypted());
+            if (mechanism.empty() || !sasl->start(mechanism, out)) {
+                sasl_failed(mechanism.empty() ? "no supported mechanism" : sasl->last_error_message());
+                return;
+            }
+            
+            send_sasl("auth", out, mechanism.c_str());
+            // PLAIN carries the password in its initial response
+            if (!out.empty()) {
+                OPENSSL_cleanse(&out[0], out.size());
+            }
+        }
+        else if (name == "challenge") {
+            if (!sasl_client::base64_decode(s->value(), in) || !sasl->challenge(in, out)) {
+                sasl_failed(sasl->last_error_message());
+                return;
+            }
+            
+            send_sasl("response", out, nullptr);
+        }
+        else if (name == "success") {
+            if (!sasl_client::base64_decode(s->value(), in) || !sasl->verify_success(in)) {
+                sasl_failed(sasl->last_error_message());
+                return;
+            }
+            
+            status_ = XMPP_STATUS_AUTHENTICATED;
+            boost::atomic_store(&sasl_, boost::shared_ptr<sasl_client>());
+            
+            protocol_->restart_stream();
+            send_stream_header();
+        }
+        else if (name == "failure") {
+            status_ = XMPP_STATUS_AUTH_FAILED;
+            boost::atomic_store(&sasl_, boost::shared_ptr<sasl_client>());
+            printf("SASL authentication failed: rejected by server\n");
+        }
+    }
+    
+    void send_sasl(const char* name, const std::string& payload, const char* mechanism) {
+        auto s = stanza::make_stanza(name);
+        s->add_attr("xmlns", protocol_->NS_XMPP_SASL);
+        if (mechanism != nullptr) {
+            s->add_attr("mechanism", mechanism);
+        }
+        
+        // "=" stands for an empty initial response
+        auto encoded = payload.empty() ? std::string("=") : sasl_client::base64_encode(payload);
+        s->set_value(encoded.c_str());
+        
+        auto data = s->to_xml();
+        nc_->write(const_cast<char*>(data.c_str()), data.size());
+    }
+    
+    void sasl_failed(const char* reason) {
+        printf("SASL authentication failed: %s\n", reason);
+        status_ = XMPP_STATUS_AUTH_FAILED;
+        
+        auto abort = std::string("<abort xmlns=\"") + protocol_->NS_XMPP_SASL + "\"/>";
+        nc_->write(const_cast<char*>(abort.c_str()), abort.size());
+        
+        // wipes the password if the exchange did not get that far
+        boost::atomic_store(&sasl_, boost::shared_ptr<sasl_client>());
+    }
+    
+    bool deliver_stanza(stanza_pt s) {
+        stanza_handler_t handler;
+        {
+            auto_lock lock(mtx_);
+            
+            if (!stanza_waiting_) {
+                return false;
+            }
+            
+            if (!stanza_handler_) {
+                stanza_queue_.push_back(s);
+                return true;
+            }
+            
+            handler.swap(stanza_handler_);
+        }
+        
+        handler(s);
+        return true;
+    }
+    
+    static void complete_iq_promise(boost::shared_ptr<boost::promise<stanza_pt> > promise, stanza_pt s, const boost::system::error_code& error) {
+        if (error) {
+            promise->set_exception(boost::copy_exception(boost::system::system_error(error)));
+        } else {
+            promise->set_value(s);
+        }
+    }
+    
+    void arm_iq_timer() {
+        iq_timer_->expires_from_now(boost::posix_time::milliseconds(IQ_SWEEP_MILLISEC));
+        iq_timer_->async_wait(boost::bind(&xmpp_client::handle_iq_timer, shared_from_this(), boost::asio::placeholders::error));
+    }
+    
+    static void cancel_iq_timer(boost::shared_ptr<boost::asio::deadline_timer> timer) {
+        boost::system::error_code ignored;
+        timer->cancel(ignored);
+    }
+    
+    void handle_iq_timer(const boost::system::error_code& error) {
+        if (error) {
+            iq_timer_armed_ = false;
+            return;
+        }
+        
+        iq_tracker_.expire();
+        
+        if (iq_tracker_.pending() > 0) {
+            arm_iq_timer();
+            return;
+        }
+        
+        // a send_iq racing with this check saw the timer armed, so look again
+        iq_timer_armed_ = false;
+        if (iq_tracker_.pending() > 0 && !iq_timer_armed_.exchange(true)) {
+            arm_iq_timer();
+        }
+    }
+
+private:
+    boost::shared_ptr<network_client> nc_;
+    boost::shared_ptr<xmpp_protocol> protocol_;
+    io_service_pt io_service_;
+    bool pooled_receive_;
+    
+    iq_tracker iq_tracker_;
+    boost::shared_ptr<boost::asio::deadline_timer> iq_timer_;
+    boost::atomic<bool> iq_timer_armed_;
+    
+    boost::shared_ptr<boost::mutex> mtx_;
+    bool stanza_waiting_;
+    stanza_handler_t stanza_handler_;
+    boost::container::deque<stanza_pt> stanza_queue_;
+    
+    std::string id_;
+    std::string host_;
+    
+    boost::shared_ptr<sasl_client> sasl_;
+    boost::atomic<int> status_;
+};
+
+#endif  // __XMPP_CLIENT_H__
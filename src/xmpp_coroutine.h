@@ -0,0 +1,209 @@
+#ifndef __XMPP_COROUTINE_H__
+#define __XMPP_COROUTINE_H__
+
+// C++20 coroutine front end for network_client and xmpp_client. Each awaiter
+// lives in the coroutine frame and registers itself as the completion handler
+// of the matching callback API, so the coroutine resumes on the connection's
+// strand and the awaiters themselves allocate nothing. What the wrapped call
+// allocates still happens: async_write goes through network_client::write,
+// which copies the data into a shared buffer and posts it to the strand.
+//
+//     xmpp_task login(xmpp_client& client) {
+//         auto error = co_await async_start(client, "example.com", 5222);
+//         ...
+//         iq_result roster = co_await async_iq(client, request);
+//         stanza_pt s = co_await async_next_stanza(client);
+//     }
+//
+// Only available when the compiler has coroutine support (-std=c++20).
+
+#if defined(__cpp_impl_coroutine) && __cpp_impl_coroutine >= 201902L
+
+#include "network_client.h"
+#include "xmpp_client.h"
+
+#include <coroutine>
+#include <exception>
+
+// Fire and forget coroutine type: starts eagerly and frees its frame when done.
+struct xmpp_task {
+    struct promise_type {
+        xmpp_task get_return_object() { return xmpp_task(); }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+};
+
+struct iq_result {
+    stanza_pt stanza;
+    boost::system::error_code error;
+};
+
+class connect_awaiter {
+public:
+    connect_awaiter(xmpp_client* client, network_client* nc, const char* host, int port, bool use_srv)
+    : client_(client), nc_(nc), host_(host), port_(port), use_srv_(use_srv) {}
+
+    bool await_ready() { return false; }
+
+    bool await_suspend(std::coroutine_handle<> handle) {
+        handle_ = handle;
+
+        auto handler = boost::bind(&connect_awaiter::complete, this, _1);
+        bool started = client_ != nullptr
+            ? client_->async_start(host_, port_, handler, use_srv_)
+            : nc_->connect(host_, port_, use_srv_, handler);
+
+        if (!started) {
+            auto nc = client_ != nullptr ? client_->network() : nc_;
+            error_ = boost::system::error_code(nc->last_error_code(), boost::system::system_category());
+            return false;
+        }
+        return true;
+    }
+
+    boost::system::error_code await_resume() { return error_; }
+
+private:
+    void complete(const boost::system::error_code& error) {
+        error_ = error;
+        handle_.resume();
+    }
+
+private:
+    xmpp_client* client_;
+    network_client* nc_;
+    const char* host_;
+    int port_;
+    bool use_srv_;
+    std::coroutine_handle<> handle_;
+    boost::system::error_code error_;
+};
+
+class write_awaiter {
+public:
+    write_awaiter(network_client* nc, const char* data, size_t size)
+    : nc_(nc), data_(data), size_(size) {}
+
+    bool await_ready() { return false; }
+
+    bool await_suspend(std::coroutine_handle<> handle) {
+        handle_ = handle;
+
+        if (!nc_->write(const_cast<char*>(data_), size_, boost::bind(&write_awaiter::complete, this, _1, _2))) {
+            error_ = boost::system::errc::make_error_code(boost::system::errc::not_connected);
+            return false;
+        }
+        return true;
+    }
+
+    boost::system::error_code await_resume() { return error_; }
+
+private:
+    void complete(const boost::system::error_code& error, size_t /* bytes_transferred */) {
+        error_ = error;
+        handle_.resume();
+    }
+
+private:
+    network_client* nc_;
+    const char* data_;
+    size_t size_;
+    std::coroutine_handle<> handle_;
+    boost::system::error_code error_;
+};
+
+class next_stanza_awaiter {
+public:
+    next_stanza_awaiter(xmpp_client* client) : client_(client), state_(pending) {}
+
+    bool await_ready() { return false; }
+
+    bool await_suspend(std::coroutine_handle<> handle) {
+        handle_ = handle;
+
+        // a queued stanza completes inline, in which case don't suspend at all
+        client_->async_next_stanza(boost::bind(&next_stanza_awaiter::complete, this, _1));
+
+        int expected = pending;
+        return state_.compare_exchange_strong(expected, suspended);
+    }
+
+    stanza_pt await_resume() { return stanza_; }
+
+private:
+    enum { pending, suspended, completed };
+
+    void complete(stanza_pt s) {
+        stanza_ = s;
+        if (state_.exchange(completed) == suspended) {
+            handle_.resume();
+        }
+    }
+
+private:
+    xmpp_client* client_;
+    stanza_pt stanza_;
+    boost::atomic<int> state_;
+    std::coroutine_handle<> handle_;
+};
+
+class iq_awaiter {
+public:
+    iq_awaiter(xmpp_client* client, stanza_pt iq, int timeout_millisec)
+    : client_(client), iq_(iq), timeout_millisec_(timeout_millisec) {}
+
+    bool await_ready() { return false; }
+
+    bool await_suspend(std::coroutine_handle<> handle) {
+        handle_ = handle;
+
+        if (!client_->send_iq(iq_, boost::bind(&iq_awaiter::complete, this, _1, _2), timeout_millisec_)) {
+            result_.error = boost::system::errc::make_error_code(boost::system::errc::not_connected);
+            return false;
+        }
+        return true;
+    }
+
+    iq_result await_resume() { return result_; }
+
+private:
+    void complete(stanza_pt s, const boost::system::error_code& error) {
+        result_.stanza = s;
+        result_.error = error;
+        handle_.resume();
+    }
+
+private:
+    xmpp_client* client_;
+    stanza_pt iq_;
+    int timeout_millisec_;
+    iq_result result_;
+    std::coroutine_handle<> handle_;
+};
+
+inline connect_awaiter async_connect(network_client& nc, const char* host, int port, bool use_srv = false) {
+    return connect_awaiter(nullptr, &nc, host, port, use_srv);
+}
+
+inline connect_awaiter async_start(xmpp_client& client, const char* host, int port, bool use_srv = false) {
+    return connect_awaiter(&client, nullptr, host, port, use_srv);
+}
+
+inline write_awaiter async_write(network_client& nc, const char* data, size_t size) {
+    return write_awaiter(&nc, data, size);
+}
+
+inline next_stanza_awaiter async_next_stanza(xmpp_client& client) {
+    return next_stanza_awaiter(&client);
+}
+
+inline iq_awaiter async_iq(xmpp_client& client, stanza_pt iq, int timeout_millisec = 10000) {
+    return iq_awaiter(&client, iq, timeout_millisec);
+}
+
+#endif  // __cpp_impl_coroutine
+
+#endif  // __XMPP_COROUTINE_H__
@@ -0,0 +1,271 @@
+#ifndef __XMPP_PROTOCOL_H__
+#define __XMPP_PROTOCOL_H__
+
+#include "network_client.h"
+#include "xml_parser.h"
+#include "auto_lock.h"
+#include "concurrent_stack.h"
+#include "stanza.h"
+#include "iq_tracker.h"
+#include "trace.h"
+
+#include <stdio.h>
+#include <iostream>
+#include <boost/container/vector.hpp>
+
+// Text at least this long moves into the stanza instead of being copied
+#define XMPP_TEXT_HANDOVER_SIZE	256
+
+class xmpp_handler {
+public:
+	virtual void on_sasl(stanza_pt s) = 0;
+	virtual void on_message(stanza_pt s) = 0;
+	virtual void on_iq(stanza_pt s) = 0;
+	virtual void on_presence(stanza_pt s) = 0;
+	virtual void on_unhandled_stanza(stanza_pt s) = 0;
+};
+
+class xmpp_protocol
+    : public iprotocol
+    , public xml_parser {
+        
+public:
+	const char* NS_XMPP_SASL = "urn:ietf:params:xml:ns:xmpp-sasl";
+
+    xmpp_protocol() : idx_(0), xmpp_handler_(nullptr), iq_tracker_(nullptr), restart_pending_(false), failed_(false), compact_parser_(false) {
+        mtx_ = boost::make_shared<boost::mutex>();
+        init();
+    }
+
+	void set_xmpp_handler(xmpp_handler* handler) {
+		xmpp_handler_ = handler;
+	}
+
+	void set_iq_tracker(iq_tracker* tracker) {
+		iq_tracker_ = tracker;
+	}
+
+	// Between stanzas, hand back what the parser grew for a large one, so an
+	// idle stream keeps about the parser's initial size.
+	void set_compact_parser(bool enable) {
+		compact_parser_ = enable;
+	}
+    
+    virtual ~xmpp_protocol() {
+        deinit();
+    }
+   
+    // The server opens a new stream after SASL success or STARTTLS, so the
+    // parser starts over before the next bytes are parsed.
+    void restart_stream() {
+        restart_pending_ = true;
+    }
+    
+    // True once the stream could not be parsed any further, be it malformed
+    // input or a parser that could not be compacted. Everything read after
+    // that is dropped until the stream restarts.
+    bool failed() {
+        return failed_;
+    }
+   
+    virtual void handle_read(char* data, size_t size) {
+        auto_lock lock(mtx_);
+        
+        if (restart_pending_) {
+            restart_pending_ = false;
+            failed_ = !init();
+            depth_ = 0;
+            while (stanza_stack_.pop() != nullptr) {
+            }
+            text_.clear();
+        }
+        
+        if (failed_) {
+            return;
+        }
+        
+        TRACE_POINT(TRACE_PARSE_BEGIN, static_cast<iprotocol*>(this), size);
+        if (!this->parse(data, (int)size, false)) {
+            failed_ = true;
+        }
+        TRACE_POINT(TRACE_PARSE_END, static_cast<iprotocol*>(this), size);
+        
+        // a failed compact has freed the old parser, the stream cannot go on
+        if (!failed_ && compact_parser_ && depth_ == 1 && can_compact() && !compact_stream()) {
+            printf("xmpp_protocol: compacting the parser failed\n");
+            failed_ = true;
+        }
+    }
+    
+    virtual void on_start_element(const XML_Char *name, const XML_Char **attrs) {
+        depth_++;
+        
+		auto s = stanza::make_stanza();
+        s->set_name(name);
+        
+        stanza_stack_.push(s);
+        
+        const XML_Char *attr_name = nullptr;
+        const XML_Char *attr_value = nullptr;
+        
+        std::cout << "on_start_element : " << name << ", depth : " << depth_ << std::endl;
+        
+        for (int i = 0; attrs[i] != nullptr; i += 2) {
+            attr_name = attrs[i];
+            attr_value = attrs[i + 1];
+            s->add_attr(attr_name, attr_value);
+            
+            std::cout << "name : " << attr_name << ", value : " << attr_value << std::endl;
+        }
+        
+    }
+    
+	// expat splits text at line breaks and at the end of every read, so the
+	// chunks are appended to the open element's buffer and only become its
+	// value in on_end_element.
+	virtual void on_visit_data(const XML_Char *data, int len) {
+		if (depth_ < 1) {
+			printf("on_visit_data not exists stanza\n");
+			return;
+		}
+
+		// between stanzas the stream only carries whitespace keepalives
+		if (depth_ == 1) {
+			return;
+		}
+
+		if (text_.size() <= (size_t)depth_) {
+			text_.resize(depth_ + 1);
+		}
+		text_[depth_].append(data, len);
+
+		std::cout << "on_visit_data : depth : " << depth_ << ", len : " << len << std::endl;
+
+	}
+
+    virtual void on_end_element(const XML_Char *name) {
+        auto s = stanza_stack_.pop();
+        
+        if (text_.size() > (size_t)depth_) {
+            if (s != nullptr) {
+                finish_text(s, text_[depth_]);
+            }
+            text_[depth_].clear();
+        }
+        
+        depth_--;
+        
+        if (s == nullptr) {
+            printf("on_end_element not exists stanza\n");
+            return;
+        }
+        
+        if (std::string(s->name()) != std::string(name)) {
+            printf("on_end_element not exists matched stanza, %s : %s \n", s->name(), name);
+            return;
+        }
+        
+        std::cout << "on_end_element : " << name << ", depth : " << depth_ << std::endl;
+        
+		if (depth_ > 1) {
+			auto parent = stanza_stack_.pop();
+			parent->add_child(s);
+			stanza_stack_.push(parent);
+		} else if (depth_ == 1) {
+			TRACE_POINT(TRACE_STANZA_COMPLETE, static_cast<iprotocol*>(this), 0);
+			TRACE_POINT(TRACE_DISPATCH_BEGIN, static_cast<iprotocol*>(this), 0);
+			handle_stanza(s);
+			TRACE_POINT(TRACE_DISPATCH_END, static_cast<iprotocol*>(this), 0);
+		}
+    }
+
+private:
+	void handle_stanza(stanza_pt s) {
+		if (xmpp_handler_ == nullptr) {
+			return;
+		}
+
+		if (s == nullptr || s->name() == nullptr) {
+			return;
+		}
+
+		std::string name = s->name();
+
+		if (name == "stream:features" && s->has_child("mechanisms", NS_XMPP_SASL)) {
+			xmpp_handler_->on_sasl(s);
+		}
+		else if (s->get_ns() != nullptr && strcmp(s->get_ns(), NS_XMPP_SASL) == 0) {
+			// challenge, success and failure
+			xmpp_handler_->on_sasl(s);
+		}
+		else if (name == "iq") {
+			if (iq_tracker_ != nullptr && is_iq_reply(s) && iq_tracker_->complete(s)) {
+				return;
+			}
+			xmpp_handler_->on_iq(s);
+		}
+		else if (name == "message") {
+			xmpp_handler_->on_message(s);
+		}
+		else if (name == "presence") {
+			xmpp_handler_->on_presence(s);
+		}
+		else {
+			xmpp_handler_->on_unhandled_stanza(s);
+		}
+	}
+
+	void finish_text(stanza_pt s, std::string& text) {
+		if (text.empty()) {
+			return;
+		}
+
+		// a long body is handed over as is, short text is copied so the
+		// buffer keeps its capacity for the next element at this depth.
+		// After a handover the buffer is the stanza's empty one, reserve what
+		// short text needs and let the next long body grow it again.
+		if (text.size() >= XMPP_TEXT_HANDOVER_SIZE) {
+			s->swap_value(text);
+			text.reserve(XMPP_TEXT_HANDOVER_SIZE);
+		} else {
+			s->set_value(text.data(), text.size());
+		}
+	}
+
+	// Only the stream element is open at depth 1, its start tag brings the
+	// namespaces back into a new parser.
+	bool compact_stream() {
+		auto stream = stanza_stack_.pop();
+		if (stream == nullptr) {
+			return true;
+		}
+		stanza_stack_.push(stream);
+
+		// text buffers are empty between stanzas, drop their capacity too
+		text_.clear();
+
+		std::string reopen;
+		stream->to_xml_head(reopen, false);
+		reopen += '>';
+		return compact(reopen.data(), (int)reopen.size());
+	}
+
+	bool is_iq_reply(stanza_pt s) {
+		auto type = s->get_attr("type");
+		return type != nullptr && (strcmp(type, "result") == 0 || strcmp(type, "error") == 0);
+	}
+    
+private:
+    int idx_;
+    boost::shared_ptr<boost::mutex> mtx_;
+    concurrent_stack<stanza_pt> stanza_stack_;
+	xmpp_handler* xmpp_handler_;
+	iq_tracker* iq_tracker_;
+	boost::atomic<bool> restart_pending_;
+	boost::atomic<bool> failed_;
+	bool compact_parser_;
+	// text of the open elements by depth, kept across stanzas
+	boost::container::vector<std::string> text_;
+};
+
+#endif  // __XMPP_PROTOCOL_H__
@@ -0,0 +1,84 @@
+#include <stdio.h>
+#include <string.h>
+
+int test_sasl_scram_sha1();
+int test_sasl_scram_sha256();
+int test_sasl_plain_needs_tls();
+int test_sasl_credentials();
+int test_ktls_loopback();
+int test_stanza_codec_roundtrip();
+int test_stanza_ring_oversize();
+int test_stanza_ring_corrupt_size();
+int test_idle_footprint();
+int test_journal_reopen_replay();
+int test_iq_tracker_out_of_order();
+int test_iq_tracker_from_check();
+int test_iq_tracker_expire();
+int test_iq_tracker_erase_shift();
+int test_resolver_happy_eyeballs();
+int test_resolver_srv();
+int test_resolver_srv_fallback();
+int test_uring_echo();
+int test_stanza_template_render();
+int test_send_batch();
+int test_trace_rings();
+int test_coroutine_session();
+int test_xmpp_protocol_failed();
+int test_xmpp_protocol_compact();
+
+struct test_case {
+    const char* name;
+    int (*run)();
+};
+
+static test_case tests[] = {
+    { "sasl_scram_sha1", test_sasl_scram_sha1 },
+    { "sasl_scram_sha256", test_sasl_scram_sha256 },
+    { "sasl_plain_needs_tls", test_sasl_plain_needs_tls },
+    { "sasl_credentials", test_sasl_credentials },
+    { "ktls_loopback", test_ktls_loopback },
+    { "stanza_codec_roundtrip", test_stanza_codec_roundtrip },
+    { "stanza_ring_oversize", test_stanza_ring_oversize },
+    { "stanza_ring_corrupt_size", test_stanza_ring_corrupt_size },
+    { "idle_footprint", test_idle_footprint },
+    { "journal_reopen_replay", test_journal_reopen_replay },
+    { "iq_tracker_out_of_order", test_iq_tracker_out_of_order },
+    { "iq_tracker_from_check", test_iq_tracker_from_check },
+    { "iq_tracker_expire", test_iq_tracker_expire },
+    { "iq_tracker_erase_shift", test_iq_tracker_erase_shift },
+    { "resolver_happy_eyeballs", test_resolver_happy_eyeballs },
+    { "resolver_srv", test_resolver_srv },
+    { "resolver_srv_fallback", test_resolver_srv_fallback },
+    { "uring_echo", test_uring_echo },
+    { "stanza_template_render", test_stanza_template_render },
+    { "send_batch", test_send_batch },
+    { "trace_rings", test_trace_rings },
+    { "coroutine_session", test_coroutine_session },
+    { "xmpp_protocol_failed", test_xmpp_protocol_failed },
+    { "xmpp_protocol_compact", test_xmpp_protocol_compact },
+};
+
+// Runs every test, or only those whose names are given.
+int main(int argc, char* argv[]) {
+    int failed = 0;
+
+    for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+        bool selected = argc < 2;
+        for (int j = 1; j < argc; j++) {
+            if (strcmp(argv[j], tests[i].name) == 0) {
+                selected = true;
+            }
+        }
+        if (!selected) {
+            continue;
+        }
+
+        int result = tests[i].run();
+        printf("%s %s\n", result == 0 ? "ok  " : "FAIL", tests[i].name);
+        if (result != 0) {
+            failed++;
+        }
+    }
+
+    return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,15 @@
+#ifndef TEST_H
+#define TEST_H
+
+#include <stdio.h>
+
+// Each test is a function returning 0 on success, registered in main.cpp.
+#define TEST_CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            return 1; \
+        } \
+    } while (0)
+
+#endif //TEST_H
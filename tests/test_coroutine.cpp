@@ -0,0 +1,99 @@
+// Built with -std=c++20 (see its compiler flags in the project), so the
+// coroutine front end is compiled even though the rest of the tree is not.
+#include "test.h"
+#include "xmpp_coroutine.h"
+
+#if !defined(__cpp_impl_coroutine) || __cpp_impl_coroutine < 201902L
+#error "test_coroutine.cpp must be compiled with -std=c++20"
+#endif
+
+#include <boost/weak_ptr.hpp>
+
+namespace {
+
+typedef boost::asio::ip::tcp::socket server_socket_t;
+
+struct session_result {
+    session_result() : done(false) {}
+
+    boost::system::error_code connect_error;
+    boost::system::error_code write_error;
+    iq_result iq;
+    stanza_pt next;
+    boost::atomic<bool> done;
+};
+
+xmpp_task session(xmpp_client& client, int port, const std::string& header, session_result& result) {
+    result.connect_error = co_await async_start(client, "127.0.0.1", port);
+    result.write_error = co_await async_write(*client.network(), header.data(), header.size());
+
+    auto iq = stanza::make_stanza("iq");
+    iq->add_attr("type", "get");
+    result.iq = co_await async_iq(client, iq, 5000);
+
+    // the message arrived together with the reply, the iq resumed us in time to take it
+    result.next = co_await async_next_stanza(client);
+    result.done = true;
+}
+
+}
+
+// Runs one coroutine through connect, write, an iq round trip and the next
+// stanza against a loopback server.
+int test_coroutine_session() {
+    boost::asio::io_service server_io;
+    boost::asio::ip::tcp::acceptor acceptor(server_io, asio_tcp_endpoint_t(boost::asio::ip::address::from_string("127.0.0.1"), 0));
+    int port = acceptor.local_endpoint().port();
+
+    std::string header = "<stream:stream xmlns='jabber:client' xmlns:stream='http://etherx.jabber.org/streams'>";
+    std::string received;
+    boost::thread server([&]() {
+        server_socket_t socket(server_io);
+        acceptor.accept(socket);
+
+        char buffer[4096];
+        boost::system::error_code error;
+        size_t iq;
+        while ((iq = received.find("<iq")) == std::string::npos || received.find('>', iq) == std::string::npos) {
+            size_t size = socket.read_some(boost::asio::buffer(buffer), error);
+            if (error) {
+                return;
+            }
+            received.append(buffer, size);
+        }
+
+        size_t id = received.find("id=\"", iq) + 4;
+        std::string reply = header +
+            "<iq type='result' id='" + received.substr(id, received.find('"', id) - id) + "'/>"
+            "<message from='a@example.com'><body>hi</body></message>";
+        boost::asio::write(socket, boost::asio::buffer(reply), error);
+
+        // stay connected until the client leaves
+        socket.read_some(boost::asio::buffer(buffer), error);
+    });
+
+    auto client = boost::make_shared<xmpp_client>();
+    session_result result;
+    session(*client, port, header, result);
+
+    for (int i = 0; i < 500 && !result.done; i++) {
+        boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+    }
+    TEST_CHECK(result.done);
+    TEST_CHECK(!result.connect_error && !result.write_error);
+    TEST_CHECK(received.compare(0, header.size(), header) == 0);
+    TEST_CHECK(!result.iq.error && result.iq.stanza != nullptr);
+    TEST_CHECK(strcmp(result.iq.stanza->get_attr("type"), "result") == 0);
+    TEST_CHECK(result.next != nullptr && strcmp(result.next->name(), "message") == 0);
+
+    boost::weak_ptr<xmpp_client> stopped = client;
+    client->stop();
+    client.reset();
+    server.join();
+
+    for (int i = 0; i < 500 && !stopped.expired(); i++) {
+        boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+    }
+    TEST_CHECK(stopped.expired());
+    return 0;
+}
@@ -0,0 +1,94 @@
+#include "test.h"
+#include "xmpp_client.h"
+#include "io_engine.h"
+
+#include <boost/weak_ptr.hpp>
+
+#define TEST_FOOTPRINT_SESSIONS	32
+#define TEST_FOOTPRINT_BODY	8000
+
+typedef boost::asio::ip::tcp::socket server_socket_t;
+
+// Opens TEST_FOOTPRINT_SESSIONS sessions on one shard, has each parse a stream
+// header and one large message, and returns what they hold once idle.
+static size_t idle_footprint(bool pooled, size_t& connection) {
+    boost::asio::io_service server_io;
+    boost::asio::ip::tcp::acceptor acceptor(server_io, asio_tcp_endpoint_t(boost::asio::ip::address::from_string("127.0.0.1"), 0));
+    int port = acceptor.local_endpoint().port();
+
+    std::string data = "<?xml version='1.0'?><stream:stream xmlns='jabber:client' xmlns:stream='http://etherx.jabber.org/streams' id='s1' version='1.0'>"
+                       "<message from='a@example.com'><body>" + std::string(TEST_FOOTPRINT_BODY, 'x') + "</body></message>";
+
+    boost::container::vector<boost::shared_ptr<server_socket_t> > sockets;
+    boost::thread server([&]() {
+        for (int i = 0; i < TEST_FOOTPRINT_SESSIONS; i++) {
+            auto socket = boost::make_shared<server_socket_t>(server_io);
+            acceptor.accept(*socket);
+            boost::asio::write(*socket, boost::asio::buffer(data));
+            sockets.push_back(socket);
+        }
+    });
+
+    io_engine engine(1, false);
+    if (!engine.start()) {
+        return 0;
+    }
+
+    boost::atomic<int> received(0);
+    boost::container::vector<boost::shared_ptr<xmpp_client> > clients;
+    for (int i = 0; i < TEST_FOOTPRINT_SESSIONS; i++) {
+        auto client = boost::make_shared<xmpp_client>();
+        client->set_io_service(engine.pick());
+        client->set_pooled_receive(pooled);
+        client->async_next_stanza([&received](stanza_pt) { received++; });
+        client->async_start("127.0.0.1", port);
+        clients.push_back(client);
+    }
+    server.join();
+
+    for (int i = 0; i < 500 && received < TEST_FOOTPRINT_SESSIONS; i++) {
+        boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+    }
+
+    size_t total = 0;
+    connection = 0;
+    if (received == TEST_FOOTPRINT_SESSIONS) {
+        for (size_t i = 0; i < clients.size(); i++) {
+            total += clients[i]->memory_footprint();
+            connection += clients[i]->network()->memory_footprint();
+        }
+    }
+
+    // the sessions must be gone before the engine stops
+    boost::container::vector<boost::weak_ptr<xmpp_client> > stopped;
+    for (size_t i = 0; i < clients.size(); i++) {
+        clients[i]->stop();
+        stopped.push_back(clients[i]);
+    }
+    clients.clear();
+    for (size_t i = 0; i < stopped.size(); i++) {
+        for (int j = 0; j < 500 && !stopped[i].expired(); j++) {
+            boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+        }
+    }
+    engine.stop();
+
+    connection /= TEST_FOOTPRINT_SESSIONS;
+    return total / TEST_FOOTPRINT_SESSIONS;
+}
+
+// Idle pooled sessions keep neither a receive buffer nor the parser buffer the
+// large message grew.
+int test_idle_footprint() {
+    size_t default_connection, pooled_connection;
+    size_t default_session = idle_footprint(false, default_connection);
+    size_t pooled_session = idle_footprint(true, pooled_connection);
+    printf("  per session: default %zu (connection %zu), pooled %zu (connection %zu)\n",
+           default_session, default_connection, pooled_session, pooled_connection);
+
+    TEST_CHECK(default_session > 0 && pooled_session > 0);
+    TEST_CHECK(default_connection >= MAX_RECV_BUFF_LEN);
+    TEST_CHECK(pooled_connection < MAX_RECV_BUFF_LEN);
+    TEST_CHECK(pooled_session + TEST_FOOTPRINT_BODY < default_session);
+    return 0;
+}
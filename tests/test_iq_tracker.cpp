@@ -0,0 +1,155 @@
+#include "test.h"
+#include "iq_tracker.h"
+
+#include <string.h>
+#include <boost/bind.hpp>
+
+namespace {
+
+struct result {
+    result() : calls(0) {}
+
+    int calls;
+    stanza_pt reply;
+    boost::system::error_code error;
+};
+
+void record(result* r, stanza_pt reply, const boost::system::error_code& error) {
+    r->calls++;
+    r->reply = reply;
+    r->error = error;
+}
+
+stanza_pt make_reply(const std::string& id, const char* from) {
+    auto s = stanza::make_stanza("iq");
+    s->add_attr("type", "result");
+    s->add_attr("id", id.c_str());
+    if (from != nullptr) {
+        s->add_attr("from", from);
+    }
+    return s;
+}
+
+}
+
+// Several requests in flight, answered in another order than they were sent.
+int test_iq_tracker_out_of_order() {
+    iq_tracker tracker;
+    result r[3];
+    std::string id[3];
+
+    for (int i = 0; i < 3; i++) {
+        tracker.add(boost::bind(record, &r[i], _1, _2), 10000, id[i], "peer@example.com/res");
+    }
+    TEST_CHECK(tracker.pending() == 3);
+    TEST_CHECK(id[0] != id[1] && id[1] != id[2]);
+
+    int order[] = { 2, 0, 1 };
+    for (int i = 0; i < 3; i++) {
+        auto reply = make_reply(id[order[i]], "peer@example.com/res");
+        TEST_CHECK(tracker.complete(reply));
+        TEST_CHECK(r[order[i]].calls == 1 && r[order[i]].reply == reply && !r[order[i]].error);
+    }
+
+    TEST_CHECK(tracker.pending() == 0);
+    TEST_CHECK(!tracker.complete(make_reply(id[0], "peer@example.com/res")));
+    return 0;
+}
+
+// A guessed id from the wrong sender neither completes nor cancels the request.
+int test_iq_tracker_from_check() {
+    iq_tracker tracker;
+    tracker.set_account("me@example.com", "example.com");
+
+    result addressed, own;
+    std::string addressed_id, own_id;
+    tracker.add(boost::bind(record, &addressed, _1, _2), 10000, addressed_id, "peer@example.com/res");
+    tracker.add(boost::bind(record, &own, _1, _2), 10000, own_id);
+
+    TEST_CHECK(!tracker.complete(make_reply(addressed_id, "evil@example.net")));
+    TEST_CHECK(!tracker.complete(make_reply(addressed_id, nullptr)));
+    TEST_CHECK(!tracker.complete(make_reply(own_id, "peer@example.com/res")));
+    TEST_CHECK(!tracker.complete(make_reply(own_id, "me@example.com/other")));
+    TEST_CHECK(addressed.calls == 0 && own.calls == 0 && tracker.pending() == 2);
+
+    TEST_CHECK(tracker.complete(make_reply(addressed_id, "peer@example.com/res")));
+    TEST_CHECK(tracker.complete(make_reply(own_id, "example.com")));
+
+    // no from, our bare jid and the domain all answer for our account
+    const char* froms[] = { nullptr, "", "me@example.com", "example.com" };
+    for (size_t i = 0; i < sizeof(froms) / sizeof(froms[0]); i++) {
+        result r;
+        std::string id;
+        tracker.add(boost::bind(record, &r, _1, _2), 10000, id);
+        TEST_CHECK(tracker.complete(make_reply(id, froms[i])));
+        TEST_CHECK(r.calls == 1);
+    }
+    return 0;
+}
+
+int test_iq_tracker_expire() {
+    iq_tracker tracker;
+    result expired[5], alive[5];
+    std::string id;
+
+    for (int i = 0; i < 5; i++) {
+        tracker.add(boost::bind(record, &expired[i], _1, _2), 0, id);
+        tracker.add(boost::bind(record, &alive[i], _1, _2), 10000, id);
+    }
+
+    TEST_CHECK(tracker.expire() == 5);
+    TEST_CHECK(tracker.pending() == 5);
+    for (int i = 0; i < 5; i++) {
+        TEST_CHECK(expired[i].calls == 1 && expired[i].reply == nullptr);
+        TEST_CHECK(expired[i].error == boost::system::errc::timed_out);
+        TEST_CHECK(alive[i].calls == 0);
+    }
+
+    // the last one added is still found after the shifts expire() did
+    TEST_CHECK(tracker.complete(make_reply(id, nullptr)));
+    TEST_CHECK(alive[4].calls == 1);
+    return 0;
+}
+
+// Sequence numbers 64 apart share a home slot in the initial table, and the
+// later ones sit displaced behind the earlier cluster, wrapping past the end.
+// Removing entries at the front must shift them back so all stay reachable.
+int test_iq_tracker_erase_shift() {
+    iq_tracker tracker;
+    const int count = 10;
+    result r[count];
+    std::string id[count];
+    uint32_t seq[count];
+
+    // seqs 1..4
+    for (int i = 0; i < 4; i++) {
+        seq[i] = tracker.add(boost::bind(record, &r[i], _1, _2), 10000, id[i]);
+    }
+
+    // one at a time, so the table keeps its initial 64 slots
+    std::string burnt;
+    uint32_t burnt_seq;
+    do {
+        burnt_seq = tracker.add(iq_callback_t(), 10000, burnt);
+        tracker.remove(burnt_seq);
+    } while (burnt_seq < 62);
+
+    // seqs 63..68: slots 63 and 0, then displaced from 1..4 into 5..8
+    for (int i = 4; i < count; i++) {
+        seq[i] = tracker.add(boost::bind(record, &r[i], _1, _2), 10000, id[i]);
+    }
+    TEST_CHECK(seq[4] == 63 && seq[count - 1] == 68);
+
+    TEST_CHECK(tracker.remove(seq[0]));
+    TEST_CHECK(tracker.remove(seq[2]));
+    TEST_CHECK(!tracker.remove(seq[0]));
+    TEST_CHECK(tracker.pending() == count - 2);
+
+    for (int i = count - 1; i >= 0; i--) {
+        bool removed = i == 0 || i == 2;
+        TEST_CHECK(tracker.complete(make_reply(id[i], nullptr)) == !removed);
+        TEST_CHECK(r[i].calls == (removed ? 0 : 1));
+    }
+    TEST_CHECK(tracker.pending() == 0);
+    return 0;
+}
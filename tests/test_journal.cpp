@@ -0,0 +1,73 @@
+#include "test.h"
+#include "journal.h"
+#include "network_client.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+
+namespace {
+
+class append_protocol : public iprotocol {
+public:
+    virtual void handle_read(char* data, size_t size) {
+        received.append(data, size);
+    }
+
+    std::string received;
+};
+
+void remove_dir(const std::string& dir) {
+    auto d = opendir(dir.c_str());
+    if (d == nullptr) {
+        return;
+    }
+    while (auto entry = readdir(d)) {
+        if (entry->d_name[0] != '.') {
+            unlink((dir + "/" + entry->d_name).c_str());
+        }
+    }
+    closedir(d);
+    rmdir(dir.c_str());
+}
+
+}
+
+// A writer opened again on the same directory must not hand out conn ids the
+// earlier run already used, or replay would mix two connections.
+int test_journal_reopen_replay() {
+    char dir[] = "/tmp/cppnet-journal-XXXXXX";
+    TEST_CHECK(mkdtemp(dir) != nullptr);
+
+    uint32_t first, second;
+    {
+        journal_writer writer(dir, 64 * 1024);
+        TEST_CHECK(writer.open());
+        first = writer.add_connection();
+        TEST_CHECK(writer.append(first, JOURNAL_INBOUND, "<stream:stream a>", 17));
+        TEST_CHECK(writer.append(first, JOURNAL_OUTBOUND, "out", 3));
+    }
+    {
+        journal_writer writer(dir, 64 * 1024);
+        TEST_CHECK(writer.open());
+        second = writer.add_connection();
+        TEST_CHECK(writer.append(second, JOURNAL_INBOUND, "<stream:stream b>", 17));
+    }
+    TEST_CHECK(second != first);
+
+    journal_replay replay(dir);
+    journal_replay_stats stats;
+
+    append_protocol a;
+    TEST_CHECK(replay.run(&a, stats, false, JOURNAL_INBOUND, first));
+    TEST_CHECK(a.received == "<stream:stream a>");
+    TEST_CHECK(stats.records == 1);
+
+    append_protocol b;
+    TEST_CHECK(replay.run(&b, stats, false, JOURNAL_INBOUND, second));
+    TEST_CHECK(b.received == "<stream:stream b>");
+
+    remove_dir(dir);
+    return 0;
+}
@@ -0,0 +1,206 @@
+#include "test.h"
+#include "network_client.h"
+#include "resolver.h"
+
+#include <string.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <boost/make_shared.hpp>
+#include <boost/weak_ptr.hpp>
+
+namespace {
+
+class null_protocol : public iprotocol {
+public:
+    virtual void handle_read(char* /* data */, size_t /* size */) {}
+};
+
+// A loopback listener nobody accepts on; connections wait in its queue.
+class listener {
+public:
+    listener() : fd_(-1), port_(0) {}
+
+    ~listener() {
+        for (size_t i = 0; i < fills_.size(); i++) {
+            ::close(fills_[i]);
+        }
+        if (fd_ >= 0) {
+            ::close(fd_);
+        }
+    }
+
+    bool open(const char* ip, int port) {
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        inet_pton(AF_INET, ip, &addr.sin_addr);
+
+        fd_ = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        socklen_t len = sizeof(addr);
+        if (fd_ < 0 || bind(fd_, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd_, 0) != 0 ||
+            getsockname(fd_, (sockaddr*)&addr, &len) != 0) {
+            return false;
+        }
+        port_ = ntohs(addr.sin_port);
+        addr_ = addr;
+        return true;
+    }
+
+    // Fills the accept queue so the kernel drops further SYNs and connecting
+    // to it hangs until the caller gives up.
+    bool blackhole() {
+        for (int i = 0; i < 8; i++) {
+            int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+            fills_.push_back(fd);
+            connect(fd, (sockaddr*)&addr_, sizeof(addr_));
+
+            pollfd p = { fd, POLLOUT, 0 };
+            if (poll(&p, 1, 100) == 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Connections the client made, counting none of our own.
+    int accepted() {
+        int count = 0, fd;
+        while ((fd = accept(fd_, nullptr, nullptr)) >= 0) {
+            ::close(fd);
+            count++;
+        }
+        return count;
+    }
+
+    int port() { return port_; }
+
+private:
+    int fd_;
+    int port_;
+    sockaddr_in addr_;
+    boost::container::vector<int> fills_;
+};
+
+struct connect_result {
+    connect_result() : done(false) {}
+
+    boost::atomic<bool> done;
+    boost::system::error_code error;
+};
+
+void record(connect_result* r, const boost::system::error_code& error) {
+    r->error = error;
+    r->done = true;
+}
+
+// Connects through the resolver and waits for the handler; returns the
+// milliseconds it took, or -1 if it never finished.
+int connect_via(iresolver_pt resolver, const char* host, int port, bool use_srv, connect_result& result) {
+    null_protocol protocol;
+    boost::weak_ptr<network_client> released;
+    int elapsed = -1;
+    {
+        auto nc = boost::make_shared<network_client>(&protocol);
+        nc->set_resolver(resolver);
+
+        if (!nc->connect(host, port, use_srv, boost::bind(record, &result, _1))) {
+            return -1;
+        }
+
+        // connect makes a certificate before anything is sent, don't count that
+        auto start = boost::posix_time::microsec_clock::universal_time();
+        for (int i = 0; i < 500 && !result.done; i++) {
+            boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+        }
+        if (result.done) {
+            elapsed = (int)(boost::posix_time::microsec_clock::universal_time() - start).total_milliseconds();
+        }
+
+        nc->close();
+        released = nc;
+    }
+
+    // the protocol must outlive the connection's handlers
+    for (int i = 0; i < 500 && !released.expired(); i++) {
+        boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+    }
+    return released.expired() ? elapsed : -1;
+}
+
+}
+
+// The first address refuses, the next one answers at once; the second hangs,
+// so the one after it is only tried once the attempt timer fires.
+int test_resolver_happy_eyeballs() {
+    listener live;
+    TEST_CHECK(live.open("127.0.0.1", 0));
+
+    {
+        auto resolver = boost::make_shared<static_resolver>();
+        resolver->add_host("refused.test", "127.0.0.3");
+        resolver->add_host("refused.test", "127.0.0.1");
+
+        connect_result result;
+        TEST_CHECK(connect_via(resolver, "refused.test", live.port(), false, result) >= 0);
+        TEST_CHECK(!result.error);
+        TEST_CHECK(live.accepted() == 1);
+    }
+
+    listener dead;
+    TEST_CHECK(dead.open("127.0.0.2", live.port()));
+    TEST_CHECK(dead.blackhole());
+    {
+        auto resolver = boost::make_shared<static_resolver>();
+        resolver->add_host("dead.test", "127.0.0.2");
+        resolver->add_host("dead.test", "127.0.0.1");
+
+        connect_result result;
+        int elapsed = connect_via(resolver, "dead.test", live.port(), false, result);
+        printf("  dead first endpoint: connected after %d ms\n", elapsed);
+        TEST_CHECK(elapsed >= CONNECT_ATTEMPT_DELAY_MILLISEC - 10);
+        TEST_CHECK(!result.error);
+        TEST_CHECK(live.accepted() == 1);
+    }
+    return 0;
+}
+
+// The SRV record points to another name and port than the ones connected to.
+int test_resolver_srv() {
+    listener live;
+    TEST_CHECK(live.open("127.0.0.1", 0));
+
+    auto resolver = boost::make_shared<static_resolver>();
+    resolver->add_srv(XMPP_CLIENT_SRV_PREFIX "example.test", "xmpp.example.test", live.port());
+    resolver->add_srv(XMPP_CLIENT_SRV_PREFIX "example.test", "missing.example.test", live.port(), 10);
+    resolver->add_host("xmpp.example.test", "127.0.0.1");
+
+    connect_result result;
+    TEST_CHECK(connect_via(resolver, "example.test", 1, true, result) >= 0);
+    TEST_CHECK(!result.error);
+    TEST_CHECK(live.accepted() == 1);
+    return 0;
+}
+
+// Without SRV records the domain itself is looked up, and an unknown name fails.
+int test_resolver_srv_fallback() {
+    listener live;
+    TEST_CHECK(live.open("127.0.0.1", 0));
+
+    auto resolver = boost::make_shared<static_resolver>();
+    resolver->add_host("example.test", "127.0.0.1");
+
+    connect_result result;
+    TEST_CHECK(connect_via(resolver, "example.test", live.port(), true, result) >= 0);
+    TEST_CHECK(!result.error);
+    TEST_CHECK(live.accepted() == 1);
+
+    connect_result unknown;
+    TEST_CHECK(connect_via(resolver, "unknown.test", live.port(), true, unknown) >= 0);
+    TEST_CHECK(unknown.error == boost::asio::error::host_not_found);
+    TEST_CHECK(live.accepted() == 0);
+    return 0;
+}
@@ -0,0 +1,85 @@
+#include "test.h"
+#include "sasl.h"
+
+// Runs one SCRAM exchange against the example of an RFC, without the key cache.
+static int scram_exchange(const char* mechanism, const char* nonce, const char* server_first,
+                          const char* client_final, const char* server_final) {
+    sasl_client client(nullptr);
+    client.set_client_nonce(nonce);
+
+    std::string out;
+    TEST_CHECK(client.start(mechanism, "user", "pencil", out));
+    TEST_CHECK(out == std::string("n,,n=user,r=") + nonce);
+
+    TEST_CHECK(client.challenge(server_first, out));
+    TEST_CHECK(out == client_final);
+
+    TEST_CHECK(client.verify_success(server_final));
+    return 0;
+}
+
+// RFC 5802 section 5
+int test_sasl_scram_sha1() {
+    TEST_CHECK(scram_exchange("SCRAM-SHA-1", "fyko+d2lbbFgONRv9qkxdawL",
+        "r=fyko+d2lbbFgONRv9qkxdawL3rfcNHYJY1ZVvWVs7j,s=QSXCR+Q6sek8bf92,i=4096",
+        "c=biws,r=fyko+d2lbbFgONRv9qkxdawL3rfcNHYJY1ZVvWVs7j,p=v0X8v3Bz2T0CJGbJQyF0X+HI4Ts=",
+        "v=rmF9pqV8S7suAoZWja4dJRkFsKQ=") == 0);
+
+    // a forged server signature must not pass
+    sasl_client client(nullptr);
+    client.set_client_nonce("fyko+d2lbbFgONRv9qkxdawL");
+    std::string out;
+    TEST_CHECK(client.start("SCRAM-SHA-1", "user", "pencil", out));
+    TEST_CHECK(client.challenge("r=fyko+d2lbbFgONRv9qkxdawL3rfcNHYJY1ZVvWVs7j,s=QSXCR+Q6sek8bf92,i=4096", out));
+    TEST_CHECK(!client.verify_success("v=AAAAAAAAAAAAAAAAAAAAAAAAAAA="));
+    return 0;
+}
+
+// RFC 7677 section 3
+int test_sasl_scram_sha256() {
+    return scram_exchange("SCRAM-SHA-256", "rOprNGfwEbeRWgbNEkqO",
+        "r=rOprNGfwEbeRWgbNEkqO%hvYDpWUa2RaTCAfuxFIlj)hNlF$k0,s=W22ZaJ0SNY7soEsUEjb6gQ==,i=4096",
+        "c=biws,r=rOprNGfwEbeRWgbNEkqO%hvYDpWUa2RaTCAfuxFIlj)hNlF$k0,p=dHzbZapWIk4jUhN+Ute9ytag9zjfMHgsqmmiz7AndVQ=",
+        "v=6rriTRBi23WpRR/wtup+mMhUZUn/dB5nLTJRsjl95G4=");
+}
+
+int test_sasl_plain_needs_tls() {
+    sasl_mechanisms_t plain_only;
+    plain_only.push_back("PLAIN");
+    TEST_CHECK(sasl_client::select(plain_only, false).empty());
+    TEST_CHECK(sasl_client::select(plain_only, true) == "PLAIN");
+
+    sasl_mechanisms_t offered;
+    offered.push_back("PLAIN");
+    offered.push_back("SCRAM-SHA-1");
+    TEST_CHECK(sasl_client::select(offered, false) == "SCRAM-SHA-1");
+    TEST_CHECK(sasl_client::select(offered, true) == "SCRAM-SHA-1");
+    return 0;
+}
+
+// Credentials handed over ahead of start(), the password is gone once used.
+int test_sasl_credentials() {
+    sasl_client scram(nullptr);
+    scram.set_client_nonce("rOprNGfwEbeRWgbNEkqO");
+    scram.set_credentials("user", "pencil");
+
+    std::string out;
+    TEST_CHECK(scram.start("SCRAM-SHA-256", out));
+    TEST_CHECK(scram.challenge("r=rOprNGfwEbeRWgbNEkqO%hvYDpWUa2RaTCAfuxFIlj)hNlF$k0,s=W22ZaJ0SNY7soEsUEjb6gQ==,i=4096", out));
+    TEST_CHECK(out == "c=biws,r=rOprNGfwEbeRWgbNEkqO%hvYDpWUa2RaTCAfuxFIlj)hNlF$k0,p=dHzbZapWIk4jUhN+Ute9ytag9zjfMHgsqmmiz7AndVQ=");
+
+    sasl_client plain(nullptr);
+    plain.set_credentials("user", "pencil");
+    TEST_CHECK(plain.start("PLAIN", out));
+    TEST_CHECK(out == std::string("\0user\0pencil", 12));
+    TEST_CHECK(plain.start("PLAIN", out));
+    TEST_CHECK(out == std::string("\0user\0", 6));
+
+    // an unsupported mechanism drops the password as well
+    sasl_client other(nullptr);
+    other.set_credentials("user", "pencil");
+    TEST_CHECK(!other.start("DIGEST-MD5", out));
+    TEST_CHECK(other.start("PLAIN", out));
+    TEST_CHECK(out == std::string("\0user\0", 6));
+    return 0;
+}
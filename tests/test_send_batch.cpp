@@ -0,0 +1,140 @@
+#include "test.h"
+#include "xmpp_client.h"
+
+#include <boost/weak_ptr.hpp>
+
+namespace {
+
+typedef boost::asio::ip::tcp::socket server_socket_t;
+
+struct write_log {
+    write_log() : count(0) {}
+
+    boost::mutex mtx;
+    boost::container::vector<std::pair<int, size_t> > writes;
+    boost::atomic<int> count;
+};
+
+void record(write_log* log, int tag, const boost::system::error_code& error, size_t size) {
+    boost::mutex::scoped_lock lock(log->mtx);
+    log->writes.push_back(std::make_pair(error ? -tag : tag, size));
+    log->count++;
+}
+
+stanza_pt make_message(const char* to, const char* body) {
+    auto s = stanza::make_stanza("message");
+    s->add_attr("to", to);
+    auto b = stanza::make_stanza("body");
+    b->set_value(body);
+    s->add_child(b);
+    return s;
+}
+
+}
+
+// Substituted addresses are escaped like any attribute, to/id already on the
+// stanza are left out, and an empty id is not written at all.
+int test_stanza_template_render() {
+    auto s = stanza::make_stanza("message");
+    s->add_attr("type", "chat");
+    s->add_attr("to", "old@example.com");
+    s->add_attr("id", "old");
+    auto body = stanza::make_stanza("body");
+    body->set_value("a < b & c");
+    s->add_child(body);
+
+    stanza_addresses_t addresses(2);
+    addresses[0].to = "o'brien&co@example.com";
+    addresses[0].id = "1\"<2>";
+    addresses[1].to = "b@example.com";
+
+    std::string out = "<prefix/>";
+    stanza_template(s).render_all(out, addresses);
+
+    TEST_CHECK(out ==
+        "<prefix/>"
+        "<message type=\"chat\" to=\"o&apos;brien&amp;co@example.com\" id=\"1&quot;&lt;2&gt;\"><body>a &lt; b &amp; c</body></message>"
+        "<message type=\"chat\" to=\"b@example.com\"><body>a &lt; b &amp; c</body></message>");
+
+    // a childless stanza keeps its self-closing tail
+    auto presence = stanza::make_stanza("presence");
+    std::string single;
+    stanza_template(presence).render(single, addresses[1]);
+    TEST_CHECK(single == "<presence to=\"b@example.com\"/>");
+    return 0;
+}
+
+// A batch goes to the socket as one write, reported once with all of its
+// bytes, and write handlers run in the order the sends were made.
+int test_send_batch() {
+    boost::asio::io_service server_io;
+    boost::asio::ip::tcp::acceptor acceptor(server_io, asio_tcp_endpoint_t(boost::asio::ip::address::from_string("127.0.0.1"), 0));
+    int port = acceptor.local_endpoint().port();
+
+    std::string received;
+    boost::thread server([&]() {
+        server_socket_t socket(server_io);
+        acceptor.accept(socket);
+
+        char buffer[4096];
+        boost::system::error_code error;
+        for (;;) {
+            size_t size = socket.read_some(boost::asio::buffer(buffer), error);
+            if (error) {
+                return;
+            }
+            received.append(buffer, size);
+        }
+    });
+
+    auto client = boost::make_shared<xmpp_client>();
+    TEST_CHECK(!client->send_batch(stanza_children_t()));
+    TEST_CHECK(client->async_start("127.0.0.1", port));
+    TEST_CHECK(client->network()->wait_connected(5000));
+
+    stanza_children_t first, last;
+    first.push_back(make_message("a@example.com", "one"));
+    first.push_back(make_message("b@example.com", "two & three"));
+    first.push_back(make_message("c@example.com", "<four>"));
+    last.push_back(make_message("d@example.com", "five"));
+
+    auto fan_out = make_message("", "six");
+    stanza_addresses_t addresses(2);
+    addresses[0].to = "e@example.com";
+    addresses[1].to = "f@example.com";
+
+    std::string expected, first_xml, fan_out_xml;
+    BOOST_FOREACH(auto s, first) {
+        s->to_xml(first_xml);
+    }
+    stanza_template(fan_out).render_all(fan_out_xml, addresses);
+    expected = first_xml + fan_out_xml + last[0]->to_xml();
+
+    write_log log;
+    TEST_CHECK(client->send_batch(first, boost::bind(record, &log, 1, _1, _2)));
+    TEST_CHECK(client->send_to_many(fan_out, addresses, boost::bind(record, &log, 2, _1, _2)));
+    TEST_CHECK(client->send_batch(last, boost::bind(record, &log, 3, _1, _2)));
+
+    for (int i = 0; i < 500 && log.count < 3; i++) {
+        boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+    }
+    {
+        boost::mutex::scoped_lock lock(log.mtx);
+        TEST_CHECK(log.writes.size() == 3);
+        TEST_CHECK(log.writes[0].first == 1 && log.writes[0].second == first_xml.size());
+        TEST_CHECK(log.writes[1].first == 2 && log.writes[1].second == fan_out_xml.size());
+        TEST_CHECK(log.writes[2].first == 3 && log.writes[2].second == last[0]->to_xml().size());
+    }
+
+    boost::weak_ptr<xmpp_client> stopped = client;
+    client->stop();
+    client.reset();
+    server.join();
+    TEST_CHECK(received == expected);
+
+    for (int i = 0; i < 500 && !stopped.expired(); i++) {
+        boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+    }
+    TEST_CHECK(stopped.expired());
+    return 0;
+}
@@ -0,0 +1,80 @@
+#include "test.h"
+#include "stanza_ring.h"
+
+#include <unistd.h>
+#include <sys/mman.h>
+
+static stanza_pt make_iq() {
+    auto iq = stanza::make_stanza("iq");
+    iq->add_attr("type", "get");
+    iq->add_attr("id", "r1");
+
+    auto query = stanza::make_stanza("query");
+    query->add_attr("xmlns", "jabber:iq:roster");
+    query->set_value("a<b");
+    iq->add_child(query);
+    return iq;
+}
+
+int test_stanza_codec_roundtrip() {
+    auto iq = make_iq();
+
+    std::string encoded;
+    TEST_CHECK(stanza_codec::encode(iq, encoded));
+    TEST_CHECK(encoded.size() == stanza_codec::encoded_size(iq));
+
+    // attribute order is the hash map's, so compare field by field
+    auto decoded = stanza_codec::decode(encoded.data(), encoded.size());
+    TEST_CHECK(decoded != nullptr);
+    TEST_CHECK(strcmp(decoded->name(), "iq") == 0);
+    TEST_CHECK(decoded->attrs() == iq->attrs());
+    TEST_CHECK(decoded->children().size() == 1);
+
+    auto query = decoded->get_child("query");
+    TEST_CHECK(query != nullptr);
+    TEST_CHECK(strcmp(query->get_ns(), "jabber:iq:roster") == 0);
+    TEST_CHECK(strcmp(query->value(), "a<b") == 0);
+
+    TEST_CHECK(stanza_codec::decode(encoded.data(), encoded.size() - 1) == nullptr);
+    return 0;
+}
+
+// Lengths past their u16 fields would be truncated, so such a stanza is refused.
+int test_stanza_ring_oversize() {
+    auto s = stanza::make_stanza("message");
+    s->add_attr(std::string(70000, 'k').c_str(), "v");
+
+    std::string encoded;
+    TEST_CHECK(stanza_codec::encoded_size(s) == 0);
+    TEST_CHECK(!stanza_codec::encode(s, encoded));
+
+    stanza_ring ring;
+    TEST_CHECK(ring.create(1024 * 1024));
+    TEST_CHECK(!ring.push(s));
+    TEST_CHECK(ring.push(make_iq()));
+    return 0;
+}
+
+// A record size the consumer cannot trust breaks the ring for both sides.
+int test_stanza_ring_corrupt_size() {
+    stanza_ring producer;
+    TEST_CHECK(producer.create(64 * 1024));
+    TEST_CHECK(producer.push(make_iq()));
+
+    stanza_ring consumer;
+    TEST_CHECK(consumer.attach(dup(producer.fd())));
+
+    size_t mapped = sizeof(stanza_ring_header) + 64 * 1024;
+    auto base = (char*)mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_SHARED, producer.fd(), 0);
+    TEST_CHECK(base != MAP_FAILED);
+    *(uint32_t*)(base + sizeof(stanza_ring_header)) = 0x7ffffff0;
+    munmap(base, mapped);
+
+    TEST_CHECK(consumer.pop(0) == nullptr);
+    TEST_CHECK(consumer.is_broken());
+    TEST_CHECK(strstr(consumer.last_error_message(), "record size") != nullptr);
+
+    TEST_CHECK(producer.is_broken());
+    TEST_CHECK(!producer.push(make_iq()));
+    return 0;
+}
@@ -0,0 +1,150 @@
+#include "test.h"
+#include "trace.h"
+
+#include <string.h>
+#include <sstream>
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+#include <boost/container/vector.hpp>
+#include <boost/unordered_map.hpp>
+
+#define TEST_TRACE_OVERRUN	100
+
+namespace {
+
+struct trace_event {
+    char name[32];
+    char phase[4];
+    bool instant;
+    double ts;
+    unsigned tid;
+    void* context;
+    unsigned arg;
+};
+
+// One line of write_chrome_json's output.
+bool parse_event(const std::string& line, trace_event& e) {
+    if (sscanf(line.c_str(), "{\"name\":\"%31[^\"]\",\"ph\":\"%3[^\"]\",", e.name, e.phase) != 2) {
+        return false;
+    }
+    e.instant = line.find("\"s\":\"t\",") != std::string::npos;
+
+    auto ts = strstr(line.c_str(), "\"ts\":");
+    int pid;
+    return ts != nullptr &&
+           sscanf(ts, "\"ts\":%lf,\"pid\":%d,\"tid\":%u,\"args\":{\"conn\":\"%p\",\"arg\":%u}}", &e.ts, &pid, &e.tid, &e.context, &e.arg) == 5 &&
+           pid == 1;
+}
+
+// The events of the given contexts, false if the document is malformed.
+bool export_events(const void* const* contexts, size_t count, boost::container::vector<trace_event>& events) {
+    std::ostringstream out;
+    trace::write_chrome_json(out);
+    auto json = out.str();
+
+    const char* head = "{\"traceEvents\":[";
+    const char* tail = "\n],\"displayTimeUnit\":\"ns\"}\n";
+    if (json.compare(0, strlen(head), head) != 0 || json.size() < strlen(head) + strlen(tail) ||
+        json.compare(json.size() - strlen(tail), strlen(tail), tail) != 0) {
+        return false;
+    }
+
+    std::istringstream in(json.substr(strlen(head), json.size() - strlen(head) - strlen(tail)));
+    std::string line;
+    while (std::getline(in, line)) {
+        // each event starts on a new line, the first one too
+        if (line.empty()) {
+            continue;
+        }
+        // every event but the last is followed by a comma
+        if (!line.empty() && line[line.size() - 1] == ',') {
+            line.erase(line.size() - 1);
+        }
+
+        trace_event e;
+        if (!parse_event(line, e)) {
+            return false;
+        }
+        for (size_t i = 0; i < count; i++) {
+            if (e.context == contexts[i]) {
+                events.push_back(e);
+            }
+        }
+    }
+    return true;
+}
+
+void record_points(const void* context, uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) {
+        trace::record((trace_point)(i % TRACE_POINT_COUNT), context, i);
+    }
+}
+
+}
+
+// Two threads each record more points than their ring holds. The export keeps
+// the newest TRACE_RING_SIZE of each, in order and under one tid per thread.
+int test_trace_rings() {
+    static const char contexts[3] = { 0 };
+    const void* threads[2] = { &contexts[0], &contexts[1] };
+    const void* local = &contexts[2];
+
+    trace::enable(true);
+    trace::clear();
+
+    boost::thread a(boost::bind(record_points, threads[0], TRACE_RING_SIZE + TEST_TRACE_OVERRUN));
+    boost::thread b(boost::bind(record_points, threads[1], TRACE_RING_SIZE + TEST_TRACE_OVERRUN));
+    a.join();
+    b.join();
+
+    // this thread's ring is made once and reused
+    record_points(local, 2);
+    record_points(local, 2);
+
+    boost::container::vector<trace_event> events;
+    TEST_CHECK(export_events(threads, 2, events));
+    TEST_CHECK(events.size() == 2 * TRACE_RING_SIZE);
+
+    boost::unordered_map<const void*, boost::container::vector<trace_event> > by_context;
+    for (size_t i = 0; i < events.size(); i++) {
+        by_context[events[i].context].push_back(events[i]);
+    }
+    TEST_CHECK(by_context.size() == 2);
+
+    const char* names[] = { "socket_read", "parse", "parse", "stanza_complete", "dispatch", "dispatch", "write_queued", "write_completed" };
+    const char* phases[] = { "i", "B", "E", "i", "B", "E", "i", "i" };
+
+    unsigned tids[2];
+    for (int t = 0; t < 2; t++) {
+        auto& list = by_context[threads[t]];
+        TEST_CHECK(list.size() == TRACE_RING_SIZE);
+        tids[t] = list[0].tid;
+
+        for (size_t i = 0; i < list.size(); i++) {
+            auto& e = list[i];
+            unsigned arg = TEST_TRACE_OVERRUN + (unsigned)i;
+            TEST_CHECK(e.arg == arg && e.tid == tids[t]);
+            TEST_CHECK(strcmp(e.name, names[arg % TRACE_POINT_COUNT]) == 0);
+            TEST_CHECK(strcmp(e.phase, phases[arg % TRACE_POINT_COUNT]) == 0);
+            TEST_CHECK(e.instant == (e.phase[0] == 'i'));
+            TEST_CHECK(e.ts >= 0 && (i == 0 || e.ts >= list[i - 1].ts));
+        }
+    }
+    TEST_CHECK(tids[0] != tids[1]);
+
+    events.clear();
+    TEST_CHECK(export_events(&local, 1, events));
+    TEST_CHECK(events.size() == 4);
+    TEST_CHECK(events[0].tid == events[3].tid && events[0].tid != tids[0] && events[0].tid != tids[1]);
+    TEST_CHECK(events[1].arg == 1 && events[2].arg == 0);
+
+    // cleared records stay out of later exports
+    trace::clear();
+    events.clear();
+    const void* all[] = { threads[0], threads[1], local };
+    TEST_CHECK(export_events(all, 3, events));
+    TEST_CHECK(events.empty());
+
+    trace::enable(false);
+    return 0;
+}
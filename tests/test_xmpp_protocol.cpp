@@ -0,0 +1,74 @@
+#include "test.h"
+#include "xmpp_protocol.h"
+
+#define TEST_PROTOCOL_STREAM	"<stream:stream xmlns='jabber:client' xmlns:stream='http://etherx.jabber.org/streams'>"
+
+namespace {
+
+class count_handler : public xmpp_handler {
+public:
+    count_handler() : messages(0) {}
+
+    virtual void on_sasl(stanza_pt) {}
+    virtual void on_iq(stanza_pt) {}
+    virtual void on_presence(stanza_pt) {}
+    virtual void on_unhandled_stanza(stanza_pt) {}
+
+    virtual void on_message(stanza_pt s) {
+        messages++;
+        last_body = s->get_child("body") != nullptr ? s->get_child("body")->value() : "";
+    }
+
+    int messages;
+    std::string last_body;
+};
+
+void feed(xmpp_protocol& protocol, const std::string& data) {
+    protocol.handle_read(const_cast<char*>(data.data()), data.size());
+}
+
+}
+
+// Malformed input fails the stream; what follows is dropped until it restarts.
+int test_xmpp_protocol_failed() {
+    count_handler handler;
+    xmpp_protocol protocol;
+    protocol.set_xmpp_handler(&handler);
+
+    feed(protocol, TEST_PROTOCOL_STREAM "<message><body>one</body></message>");
+    TEST_CHECK(handler.messages == 1 && !protocol.failed());
+
+    feed(protocol, "<message><body>two</bad>");
+    TEST_CHECK(protocol.failed());
+
+    feed(protocol, "<message><body>three</body></message>");
+    TEST_CHECK(handler.messages == 1 && protocol.failed());
+
+    protocol.restart_stream();
+    feed(protocol, TEST_PROTOCOL_STREAM "<message><body>four</body></message>");
+    TEST_CHECK(!protocol.failed());
+    TEST_CHECK(handler.messages == 2 && handler.last_body == "four");
+    return 0;
+}
+
+// Compacting after a large stanza keeps the stream going with a smaller parser.
+int test_xmpp_protocol_compact() {
+    count_handler handler;
+    xmpp_protocol protocol;
+    protocol.set_xmpp_handler(&handler);
+    protocol.set_compact_parser(true);
+
+    feed(protocol, TEST_PROTOCOL_STREAM);
+    size_t initial = protocol.memory_footprint();
+
+    std::string body(4 * XML_PARSER_COMPACT_SLACK, 'x');
+    feed(protocol, "<message><body>" + body + "</body></message>");
+    TEST_CHECK(handler.messages == 1 && handler.last_body == body);
+    TEST_CHECK(!protocol.failed());
+    TEST_CHECK(protocol.memory_footprint() < initial + XML_PARSER_COMPACT_SLACK);
+
+    feed(protocol, "<message><body>small</body></message>");
+    TEST_CHECK(!protocol.failed());
+    TEST_CHECK(handler.messages == 2 && handler.last_body == "small");
+    return 0;
+}